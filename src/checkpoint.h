@@ -0,0 +1,259 @@
+/*****************************************************************************
+* name: checkpoint.h
+*
+* author: Biryukov V. biryukov.vova@gmail.com
+*
+* desc: Pipeline stages and their binary checkpoint files
+*
+* license: GPLv3
+*
+*****************************************************************************/
+
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+#include "settings.h"
+namespace swift
+{
+    // Stages of the mesh pipeline in the order they run
+    enum pipeline_stage
+    {
+        stage_surface,  // figure triangulation
+        stage_plc,      // tetgen input assembly
+        stage_volume,   // tetrahedralization
+        stage_split,    // cell partitioning
+        stage_export,   // submesh files
+        stages_count
+    };
+
+    inline const char * get_stage_name( int stage )
+    {
+        static const char * names[stages_count] = {"surface", "plc", "volume", "split", "export"};
+        return (stage >= 0 && stage < stages_count) ? names[stage] : "unknown";
+    }
+
+    // Returns stages_count for an unknown name
+    inline pipeline_stage get_stage_by_name( const std::string & name )
+    {
+        for (int i = 0; i < stages_count; i++)
+            if (name == get_stage_name(i))
+                return pipeline_stage(i);
+        return stages_count;
+    }
+
+    // 64-bit FNV-1a of everything a stage depends on
+    struct hasher
+    {
+        unsigned long long value;
+
+        hasher( unsigned long long seed = 14695981039346656037ULL )
+        {
+            value = seed;
+        }
+
+        void add( const void * data, size_t size )
+        {
+            const unsigned char * p = (const unsigned char *) data;
+            for (size_t i = 0; i < size; i++)
+            {
+                value ^= p[i];
+                value *= 1099511628211ULL;
+            }
+        }
+
+        // Length first, so that consecutive strings cannot run together
+        void add( const std::string & s )
+        {
+            unsigned long long n = s.size();
+            add(&n, sizeof(n));
+            add(s.data(), s.size());
+        }
+
+        // Hashes the contents of a file, or just its name if it cannot be read
+        void add_file( const std::string & path )
+        {
+            add(path);
+            std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+            if (!file)
+                return;
+            char buf[1 << 16];
+            while (file.read(buf, sizeof(buf)) || file.gcount() > 0)
+                add(buf, size_t(file.gcount()));
+        }
+    };
+
+    struct config_entry
+    {
+        std::string section, name, value;
+    };
+
+    // Reads the name = value pairs of an ini file, dropping comments after
+    // ; or // and surrounding blanks the way Profile does
+    inline std::vector<config_entry> read_config_entries( const std::string & path )
+    {
+        std::vector<config_entry> entries;
+        std::ifstream file(path.c_str());
+        std::string line, section;
+        const char * blanks = " \t\r\n";
+        while (std::getline(file, line))
+        {
+            size_t c = std::min(line.find(';'), line.find("//"));
+            if (c != std::string::npos)
+                line.erase(c);
+            size_t b = line.find_first_not_of(blanks);
+            if (b == std::string::npos)
+                continue;
+            line = line.substr(b, line.find_last_not_of(blanks) - b + 1);
+            if (line[0] == '[')
+            {
+                section = line.substr(1, line.find(']') - 1);
+                continue;
+            }
+            config_entry e;
+            e.section = section;
+            size_t eq = line.find('=');
+            e.name = line.substr(0, eq);
+            e.name.erase(e.name.find_last_not_of(blanks) + 1);
+            if (eq != std::string::npos)
+            {
+                e.value = line.substr(eq + 1);
+                e.value.erase(0, e.value.find_first_not_of(blanks));
+            }
+            entries.push_back(e);
+        }
+        return entries;
+    }
+
+    // A checkpoint starts with a header of the format version, the stage and
+    // the key of its inputs, followed by raw arrays each preceded by its
+    // length. It is written to a temporary file renamed when complete, so
+    // an interrupted run never leaves a truncated checkpoint behind.
+    struct checkpoint_header
+    {
+        char magic[4];
+        int version;
+        int stage;
+        unsigned long long key;
+    };
+
+    inline checkpoint_header get_checkpoint_header( int stage, unsigned long long key )
+    {
+        checkpoint_header h = {{'S', 'W', 'C', 'P'}, 1, stage, key};
+        return h;
+    }
+
+    inline std::string get_checkpoint_path( const std::string & directory, int stage )
+    {
+        return directory + "/" + get_stage_name(stage) + ".chk";
+    }
+
+    struct checkpoint_writer
+    {
+        std::ofstream file;
+        std::string path;
+
+        checkpoint_writer( const std::string & directory, int stage, unsigned long long key )
+        {
+            path = get_checkpoint_path(directory, stage);
+            file.open((path + ".tmp").c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+            checkpoint_header h = get_checkpoint_header(stage, key);
+            file.write((const char*)&h, sizeof(h));
+        }
+
+        template<typename T>
+        void write_value( const T & v )
+        {
+            file.write((const char*)&v, sizeof(T));
+        }
+
+        template<typename T>
+        void write_array( const T * data, unsigned long long count )
+        {
+            write_value(count);
+            if (count > 0)
+                file.write((const char*)data, count * sizeof(T));
+        }
+
+        template<typename T>
+        void write_vector( const std::vector<T> & v )
+        {
+            write_array(v.empty() ? (const T *) NULL : &v[0], v.size());
+        }
+
+        // Returns false if anything failed to be written
+        bool close()
+        {
+            file.close();
+            if (!file)
+            {
+                std::remove((path + ".tmp").c_str());
+                return false;
+            }
+            std::remove(path.c_str());
+            return std::rename((path + ".tmp").c_str(), path.c_str()) == 0;
+        }
+    };
+
+    struct checkpoint_reader
+    {
+        std::ifstream file;
+        unsigned long long remaining;
+        bool valid;
+
+        // valid is false if the file is missing or was made for other inputs
+        checkpoint_reader( const std::string & directory, int stage, unsigned long long key )
+        {
+            file.open(get_checkpoint_path(directory, stage).c_str(), std::ios::in | std::ios::binary);
+            file.seekg(0, std::ios::end);
+            remaining = file ? (unsigned long long) file.tellg() : 0;
+            file.seekg(0, std::ios::beg);
+            checkpoint_header expected = get_checkpoint_header(stage, key), h;
+            valid = read_bytes(&h, sizeof(h)) && std::equal(h.magic, h.magic + 4, expected.magic) &&
+                    h.version == expected.version && h.stage == expected.stage && h.key == expected.key;
+        }
+
+        template<typename T>
+        bool read_value( T & v )
+        {
+            return read_bytes(&v, sizeof(T));
+        }
+
+        // Reads the length of the next array, refusing lengths the rest of
+        // the file cannot hold
+        template<typename T>
+        bool read_length( unsigned long long & count )
+        {
+            valid = read_value(count) && count <= remaining / sizeof(T);
+            return valid;
+        }
+
+        template<typename T>
+        bool read_data( T * data, unsigned long long count )
+        {
+            return read_bytes(data, count * sizeof(T));
+        }
+
+        template<typename T>
+        bool read_vector( std::vector<T> & v )
+        {
+            unsigned long long count;
+            if (!read_length<T>(count))
+                return false;
+            v.resize(count);
+            return count == 0 || read_data(&v[0], count);
+        }
+
+    private:
+        bool read_bytes( void * data, unsigned long long size )
+        {
+            if (!file || size > remaining)
+                return valid = false;
+            file.read((char*)data, size);
+            remaining -= size;
+            return valid = bool(file);
+        }
+    };
+}
@@ -0,0 +1,81 @@
+/*****************************************************************************
+* name: edge_index.h
+*
+* author: Biryukov V. biryukov.vova@gmail.com
+*
+* desc: Hash registry of a figure's edges by their end points
+*
+* license: GPLv3
+*
+*****************************************************************************/
+
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include "edge.h"
+#include "settings.h"
+namespace swift
+{
+    // Maps an unordered (start, finish) pair to the first edge of the
+    // indexed vector with these end points, the same one std::find returns
+    struct edge_index
+    {
+        std::unordered_map<unsigned long long, int> first;
+        int indexed;
+
+        edge_index()
+        {
+            indexed = 0;
+        }
+
+        void clear()
+        {
+            first.clear();
+            indexed = 0;
+        }
+
+        // Like clear, but also gives back the buckets
+        void release()
+        {
+            std::unordered_map<unsigned long long, int>().swap(first);
+            indexed = 0;
+        }
+
+        // Finds the edge between points s and f, returns -1 if there is none
+        int find( const std::vector< edge > & ve, int s, int f )
+        {
+            sync(ve);
+            std::unordered_map<unsigned long long, int>::const_iterator it = first.find(get_key(s, f));
+            return (it == first.end()) ? -1 : it->second;
+        }
+
+        // Returns the edge between points s and f, appending it to ve if needed
+        int find_or_add( std::vector< edge > & ve, int s, int f )
+        {
+            int i = find(ve, s, f);
+            if (i != -1)
+                return i;
+            ve.push_back(edge(s, f));
+            sync(ve);
+            return ve.size()-1;
+        }
+
+        // Indexes edges appended to ve since the last call
+        void sync( const std::vector< edge > & ve )
+        {
+            if (int(ve.size()) < indexed)
+                clear();
+            for (; indexed < int(ve.size()); indexed++)
+                first.insert(std::make_pair(get_key(ve[indexed].start_point, ve[indexed].finish_point), indexed));
+        }
+
+    private:
+        static unsigned long long get_key( int s, int f )
+        {
+            if (s > f)
+                std::swap(s, f);
+            return ((unsigned long long)(unsigned int)s << 32) | (unsigned int)f;
+        }
+    };
+}
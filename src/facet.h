@@ -16,13 +16,13 @@
 #include <sstream>
 #include <string>
 #include <algorithm>
+#include <unordered_map>
 #include "point.h"
 #include "edge.h"
+#include "edge_index.h"
+#include "point_index.h"
+#include "triangle_workspace.h"
 #include "settings.h"
-extern "C"
-{
-#include "triangle.h"
-}
 
 
 namespace swift
@@ -30,6 +30,7 @@ namespace swift
     struct trifacet
     {
         int points[3];
+        trifacet( void ) {}
         trifacet( int p1, int p2, int p3 )
         {
             points[0] = p1;
@@ -44,6 +45,7 @@ namespace swift
         std::vector< int > points;
         std::vector< int > trifacets;
         std::vector< trifacet > full_trifacets;
+        std::vector< point > interior_points;
 
         facet(std::vector<int> e)
         {
@@ -76,39 +78,55 @@ namespace swift
             }
         }
 
-        void add_edges_by_points(std::vector<edge> & ve)
+        void add_edges_by_points(std::vector<edge> & ve, edge_index & ve_index)
         {
             for (unsigned int i = 0; i < points.size(); i++)
             {
-                edge e = edge(points.at(i), points.at((i+1) % points.size()));
-                if (std::find(ve.begin(), ve.end(), e) == ve.end())
-                {
-                    ve.push_back(e);
-                    edges.push_back(ve.size()-1);
-                }
-                else
-                {
-                    edges.push_back(std::distance(ve.begin(), std::find(ve.begin(), ve.end(), e)));
-                }
+                edges.push_back(ve_index.find_or_add(ve, points.at(i), points.at((i+1) % points.size())));
             }
         }
 
-        void add_segments_from_edges (std::vector<int> &vs, std::vector<edge> & ve)
+        // Maps the global index of every facet point to its position in points.
+        // A point listed twice keeps its first position, as std::find would give.
+        void get_local_indices (std::unordered_map<int, int> & local) const
         {
-            for (std::vector<int>::iterator e = edges.begin(); e != edges.end(); e++)
-                for (std::vector<int>::iterator it = ve.at(*e).points.begin();it != ve.at(*e).points.end() - 1; it++)
+            local.clear();
+            local.reserve(points.size());
+            for (unsigned int i = 0; i < points.size(); i++)
+                local.insert(std::make_pair(points[i], int(i)));
+        }
+
+        void add_segments_from_edges (std::vector<int> &vs, const std::vector<edge> & ve, const std::unordered_map<int, int> & local)
+        {
+            for (std::vector<int>::const_iterator e = edges.begin(); e != edges.end(); e++)
+                for (std::vector<int>::const_iterator it = ve.at(*e).points.begin();it != ve.at(*e).points.end() - 1; it++)
                     {
-                        int p1 = std::distance(points.begin(), std::find(points.begin(), points.end(), *it));
-                        int p2 = std::distance(points.begin(), std::find(points.begin(), points.end(), *(it+1)));
-                        vs.push_back(p1);
-                        vs.push_back(p2);
+                        std::unordered_map<int, int>::const_iterator p1 = local.find(*it);
+                        std::unordered_map<int, int>::const_iterator p2 = local.find(*(it+1));
+                        vs.push_back(p1 == local.end() ? int(points.size()) : p1->second);
+                        vs.push_back(p2 == local.end() ? int(points.size()) : p2->second);
                     }
         }
 
-        void make_triangulation( std::vector< point > & vp, std::vector< trifacet > & vt, std::vector<edge> & ve, REAL av_step = 0)
+        void make_triangulation( std::vector< point > & vp, std::vector< trifacet > & vt, std::vector<edge> & ve, edge_index & ve_index, REAL av_step = 0)
         {
-            add_edges_by_points(ve);
+            set_boundary_points(vp, ve, ve_index, av_step);
+            triangulate_boundary(vp, ve, av_step);
+            merge_triangulation(vp, vt);
+        }
+
+        // Registers the facet's edges, discretizes the ones that are not yet
+        // and collects their points as the facet boundary
+        void set_boundary_points( std::vector< point > & vp, std::vector<edge> & ve, edge_index & ve_index, REAL av_step )
+        {
+            add_edges_by_points(ve, ve_index);
             //add_corner_points(ve);
+            add_edge_points(vp, ve, av_step);
+        }
+
+        // Discretizes the facet's edges that are not yet and appends their inner points
+        void add_edge_points( std::vector< point > & vp, std::vector<edge> & ve, REAL av_step )
+        {
             // Creating points on all edges
             for ( unsigned int i = 0; i < edges.size(); i++ )
             {
@@ -122,163 +140,203 @@ namespace swift
                     points.push_back(*jt);
                 }
             }
-            // Calculating three main points in order to calculate a normal
-            assert (points.size() >= 3);
-            std::vector<point> main_points;
-            main_points.push_back(vp.at(points.at(0)));
-            main_points.push_back(vp.at(points.at(1)));
-            main_points.push_back(vp.at(points.at(2)));
-            point normal = (main_points[0] - main_points[1]).vec(main_points[0] - main_points[2]);
-            normal = normal / normal.norm();
-            point p0 = main_points[1] - main_points[0];
-            p0 = p0 / p0.norm();
+        }
 
-            //if (use_triangle_over_fade)
+        // Runs Triangle inside the facet boundary. Only reads vp and ve, so
+        // facets with discretized edges may be triangulated concurrently;
+        // the new points wait in interior_points for merge_triangulation.
+        void triangulate_boundary( const std::vector< point > & vp, const std::vector<edge> & ve, REAL av_step )
+        {
+            if (triangulate_passthrough() || triangulate_structured(vp, ve))
+                return;
+
+            point normal, p0;
+            get_plane_basis(vp, normal, p0);
+
+            std::unordered_map<int, int> local;
+            get_local_indices(local);
+            std::vector<int> temp_vec;
+            add_segments_from_edges(temp_vec, ve, local);
+
+            triangle_workspace & ws = triangle_workspace::local();
+            ws.set_input(points.size(), temp_vec.size() / 2);
+            for (int i = 0; i < ws.in.numberofpoints; i++)
             {
-                struct triangulateio in, out;
-                // Setting triangulateio in and out:
-
-                in.pointlist = (REAL*)(NULL);
-				in.pointattributelist = (REAL*)(NULL);
-				in.pointmarkerlist = (int*)(NULL);
-				in.numberofpoints = 0;
-				in.numberofpointattributes = 0;
-
-				in.trianglelist = (int*)(NULL);
-				in.triangleattributelist = (REAL*)(NULL);
-				in.trianglearealist = (REAL*)(NULL);
-				in.neighborlist = (int*)(NULL);
-				in.numberoftriangles = 0;
-				in.numberofcorners = 0;
-				in.numberoftriangleattributes = 0;
-
-				in.segmentlist = (int*)(NULL);
-				in.segmentmarkerlist = (int*)(NULL);
-				in.numberofsegments = 0;
-
-				in.holelist = (REAL*)(NULL);
-				in.numberofholes = 0;
-
-				in.regionlist = (REAL*)(NULL);
-				in.numberofregions = 0;
-
-				in.edgelist = (int*)(NULL);
-				in.edgemarkerlist = (int*)(NULL);
-				in.normlist = (REAL*)(NULL);
-				in.numberofedges = 0;
-
-                in.numberofpoints = points.size();
-                in.numberofpointattributes = 0;
-                in.pointlist = (REAL *) malloc(in.numberofpoints * 2 * sizeof(REAL));
-                in.pointmarkerlist = (int *) NULL;
-                in.pointattributelist = (REAL *) NULL;
-
-                for (int i = 0; i < in.numberofpoints; i++)
-                {
-                    in.pointlist[2*i + 0] = (vp.at(points[i])).projx(normal, p0);
-                    in.pointlist[2*i + 1] = (vp.at(points[i])).projy(normal, p0);
-                    //std::cout << "" << in.pointlist[2*i + 0] << " " << in.pointlist[2*i + 1] << std::endl;
-                }
+                ws.in.pointlist[2*i + 0] = (vp.at(points[i])).projx(normal, p0);
+                ws.in.pointlist[2*i + 1] = (vp.at(points[i])).projy(normal, p0);
+            }
+            std::copy(temp_vec.begin(), temp_vec.end(), ws.in.segmentlist);
+
+            ws.set_switches("pzqQYa", av_step * av_step / 2);
+            ws.triangulate();
+
+            for (int i = ws.in.numberofpoints; i < ws.out.numberofpoints; i++)
+            {
+                interior_points.push_back(normal * normal.dot(vp.at(points.at(0))) + get_by_proj(normal, ws.out.pointlist[2*i], ws.out.pointlist[2*i+1], p0));
+            }
+
+            for (int i = 0; i < ws.out.numberoftriangles; i++)
+            {
+                full_trifacets.push_back(trifacet(ws.out.trianglelist[3*i], ws.out.trianglelist[3*i + 1], ws.out.trianglelist[3*i + 2]));
+            }
+            ws.release_output();
+        }
 
-                in.numberofsegments = in.numberofpoints;
-                in.segmentlist = (int *) malloc(in.numberofsegments * 2 * sizeof(int));
-				in.segmentmarkerlist = (int *) NULL;
-                std::vector<int> temp_vec;
-                add_segments_from_edges(temp_vec, ve);
-                std::copy(temp_vec.begin(), temp_vec.end(),in.segmentlist);
-
-
-                out.pointlist = (REAL*)(NULL);
-				out.pointattributelist = (REAL*)(NULL);
-				out.pointmarkerlist = (int*)(NULL);
-				out.numberofpoints = 0;
-				out.numberofpointattributes = 0;
-
-				out.trianglelist = (int*)(NULL);
-				out.triangleattributelist = (REAL*)(NULL);
-				out.trianglearealist = (REAL*)(NULL);
-				out.neighborlist = (int*)(NULL);
-				out.numberoftriangles = 0;
-				out.numberofcorners = 0;
-				out.numberoftriangleattributes = 0;
-
-				out.segmentlist = (int*)(NULL);
-				out.segmentmarkerlist = (int*)(NULL);
-				out.numberofsegments = 0;
-
-				out.holelist = (REAL*)(NULL);
-				out.numberofholes = 0;
-
-				out.regionlist = (REAL*)(NULL);
-				out.numberofregions = 0;
-
-				out.edgelist = (int*)(NULL);
-				out.edgemarkerlist = (int*)(NULL);
-				out.normlist = (REAL*)(NULL);
-				out.numberofedges = 0;
-
-                std::stringstream ss5;
-                ss5 << "pzqQYa" << av_step * av_step / 2;
-                std::string str;
-                ss5 >> str;
-                char * s = new char[str.size() + 1];
-                std::copy(str.begin(), str.end(), s);
-                s[str.size()] = '\0';
-                triangulate(s, &in, &out, (struct triangulateio *) NULL);
-
-
-                for (int i = in.numberofpoints; i < out.numberofpoints; i++)
+        // A triangle whose edges got no inner points is already as fine as
+        // the edges and is emitted as it is
+        bool triangulate_passthrough()
+        {
+            if (edges.size() != 3 || points.size() != 3)
+                return false;
+            full_trifacets.push_back(trifacet(0, 1, 2));
+            return true;
+        }
+
+        // Meshes a convex planar quad whose opposite edges have the same number
+        // of points with a transfinite grid through the edge points, cutting
+        // every cell along its shorter diagonal. Returns false for any other
+        // boundary, leaving it to Triangle.
+        bool triangulate_structured( const std::vector< point > & vp, const std::vector<edge> & ve )
+        {
+            if (edges.size() != 4)
+                return false;
+            // Corners c[k], edges[k] going from c[k] to c[k+1]
+            int c[5];
+            const edge & e0 = ve.at(edges[0]);
+            const edge & e1 = ve.at(edges[1]);
+            bool forward = (e0.finish_point == e1.start_point || e0.finish_point == e1.finish_point);
+            c[0] = forward ? e0.start_point : e0.finish_point;
+            c[1] = forward ? e0.finish_point : e0.start_point;
+            for (int k = 1; k < 4; k++)
+            {
+                const edge & e = ve.at(edges[k]);
+                if (e.start_point == c[k])
+                    c[k+1] = e.finish_point;
+                else if (e.finish_point == c[k])
+                    c[k+1] = e.start_point;
+                else
+                    return false;
+            }
+            if (c[4] != c[0] || c[2] == c[0] || c[3] == c[1])
+                return false;
+
+            // Sides as point lists from c[k] to c[k+1]. Edges filled by
+            // take_triangulation may list their points from finish to start.
+            std::vector<int> side[4];
+            unsigned int inner = 0;
+            for (int k = 0; k < 4; k++)
+            {
+                const edge & e = ve.at(edges[k]);
+                if (e.points.size() < 2)
+                    return false;
+                side[k] = e.points;
+                if (side[k].front() != c[k])
+                    std::reverse(side[k].begin(), side[k].end());
+                if (side[k].front() != c[k] || side[k].back() != c[k+1])
+                    return false;
+                inner += e.points.size() - 2;
+            }
+            int n = side[0].size() - 1, m = side[1].size() - 1;
+            if (points.size() != 4 + inner || int(side[2].size()) - 1 != n || int(side[3].size()) - 1 != m)
+                return false;
+
+            point p[4];
+            for (int k = 0; k < 4; k++)
+                p[k] = vp.at(c[k]);
+            point turn[4];
+            for (int k = 0; k < 4; k++)
+                turn[k] = (p[(k+1)%4] - p[k]).vec(p[(k+2)%4] - p[(k+1)%4]);
+            for (int k = 1; k < 4; k++)
+                if (!(turn[k].dot(turn[0]) > 0))
+                    return false;
+            point normal = turn[0] / turn[0].norm();
+            REAL size = std::max((p[2] - p[0]).norm(), (p[3] - p[1]).norm());
+            if (!(fabs(normal.dot(p[3] - p[0])) <= 1e-6 * size))
+                return false;
+
+            // Grid nodes (i, j), i along side 0 and j along side 1
+            std::unordered_map<int, int> local;
+            get_local_indices(local);
+            std::vector<point> grid((n+1) * (m+1));
+            std::vector<int> node((n+1) * (m+1));
+            for (int j = 0; j <= m; j++)
+                for (int i = 0; i <= n; i++)
                 {
-                    vp.push_back(normal * normal.dot(main_points[0]) + get_by_proj(normal, out.pointlist[2*i], out.pointlist[2*i+1], p0));
-                    points.push_back(vp.size()-1);
+                    int g = -1;
+                    if (j == 0) g = side[0][i];
+                    else if (i == n) g = side[1][j];
+                    else if (j == m) g = side[2][n-i];
+                    else if (i == 0) g = side[3][m-j];
+                    if (g != -1)
+                    {
+                        grid[j*(n+1) + i] = vp.at(g);
+                        node[j*(n+1) + i] = local.at(g);
+                        continue;
+                    }
+                    REAL u = REAL(i) / n, v = REAL(j) / m;
+                    point x = vp.at(side[0][i]) * (1-v) + vp.at(side[2][n-i]) * v
+                            + vp.at(side[3][m-j]) * (1-u) + vp.at(side[1][j]) * u
+                            - (p[0] * ((1-u)*(1-v)) + p[1] * (u*(1-v)) + p[2] * (u*v) + p[3] * ((1-u)*v));
+                    grid[j*(n+1) + i] = x;
+                    node[j*(n+1) + i] = points.size() + interior_points.size();
+                    interior_points.push_back(x);
                 }
-
-                for (int i = 0; i < out.numberoftriangles; i++)
+            for (int j = 0; j < m; j++)
+                for (int i = 0; i < n; i++)
                 {
-                    vt.push_back(trifacet(points[out.trianglelist[3*i]], points[out.trianglelist[3*i + 1]], points[out.trianglelist[3*i + 2]]));
-                    trifacets.push_back(vt.size()-1);
-                    full_trifacets.push_back(trifacet(out.trianglelist[3*i], out.trianglelist[3*i + 1], out.trianglelist[3*i + 2]));
+                    int a = j*(n+1) + i, b = a + 1, d = a + n + 1, e = d + 1;
+                    if ((grid[e] - grid[a]).norm() <= (grid[d] - grid[b]).norm())
+                    {
+                        full_trifacets.push_back(trifacet(node[a], node[b], node[e]));
+                        full_trifacets.push_back(trifacet(node[a], node[e], node[d]));
+                    }
+                    else
+                    {
+                        full_trifacets.push_back(trifacet(node[a], node[b], node[d]));
+                        full_trifacets.push_back(trifacet(node[b], node[e], node[d]));
+                    }
                 }
-				
-
-				if (in.pointlist)             free(in.pointlist);
-			    if (in.pointattributelist)    free(in.pointattributelist);
-			    if (in.pointmarkerlist)       free(in.pointmarkerlist);
-			    if (in.trianglelist)          free(in.trianglelist);
-			    if (in.triangleattributelist) free(in.triangleattributelist);
-			    if (in.trianglearealist)      free(in.trianglearealist);
-			    if (in.neighborlist)          free(in.neighborlist);
-			    if (in.segmentlist)           free(in.segmentlist);
-			    if (in.segmentmarkerlist)     free(in.segmentmarkerlist);
-			    if (in.regionlist)            free(in.regionlist);
-			    if (in.edgelist)              free(in.edgelist);
-			    if (in.edgemarkerlist)        free(in.edgemarkerlist);
-			    if (in.normlist)              free(in.normlist);
-
-				if (out.pointlist)             free(out.pointlist);
-			    if (out.pointattributelist)    free(out.pointattributelist);
-			    if (out.pointmarkerlist)       free(out.pointmarkerlist);
-			    if (out.trianglelist)          free(out.trianglelist);
-			    if (out.triangleattributelist) free(out.triangleattributelist);
-			    if (out.trianglearealist)      free(out.trianglearealist);
-			    if (out.neighborlist)          free(out.neighborlist);
-			    if (out.segmentlist)           free(out.segmentlist);
-			    if (out.segmentmarkerlist)     free(out.segmentmarkerlist);
-			    if (out.regionlist)            free(out.regionlist);
-			    if (out.edgelist)              free(out.edgelist);
-			    if (out.edgemarkerlist)        free(out.edgemarkerlist);
-			    if (out.normlist)              free(out.normlist);
+            return true;
+        }
 
+        // Unit normal of the facet plane and the in-plane x axis Triangle works in
+        void get_plane_basis( const std::vector< point > & vp, point & normal, point & p0 ) const
+        {
+            // Calculating three main points in order to calculate a normal
+            assert (points.size() >= 3);
+            const point & m0 = vp.at(points.at(0));
+            const point & m1 = vp.at(points.at(1));
+            const point & m2 = vp.at(points.at(2));
+            normal = (m0 - m1).vec(m0 - m2);
+            normal = normal / normal.norm();
+            p0 = m1 - m0;
+            p0 = p0 / p0.norm();
+        }
+
+        // Appends the points and triangles found by triangulate_boundary to the figure
+        void merge_triangulation( std::vector< point > & vp, std::vector< trifacet > & vt )
+        {
+            for (unsigned int i = 0; i < interior_points.size(); i++)
+            {
+                vp.push_back(interior_points[i]);
+                points.push_back(vp.size()-1);
+            }
+            std::vector< point >().swap(interior_points);
+
+            for (unsigned int i = 0; i < full_trifacets.size(); i++)
+            {
+                vt.push_back(trifacet(points[full_trifacets[i].points[0]], points[full_trifacets[i].points[1]], points[full_trifacets[i].points[2]]));
+                trifacets.push_back(vt.size()-1);
             }
         }
 
-        void take_triangulation( std::vector< point > & vp, std::vector< trifacet > & vt, std::vector<edge> & ve, facet & f)
+        void take_triangulation( std::vector< point > & vp, std::vector< trifacet > & vt, std::vector<edge> & ve, facet & f, point_index & vp_index, edge_index & ve_index)
         {
 
             using std::vector;
             using std::find;
 
-            add_edges_by_points(ve);
+            add_edges_by_points(ve, ve_index);
 
             vector<point> main_points;
             for ( unsigned int i = 0; i < edges.size(); i++ )
@@ -322,31 +380,25 @@ namespace swift
                 {
                     int pe = ve.at(f.edges.at(i)).points.at(j);
                     point p = project(vp.at(pe), dif, normal, (main_points.at(0) + main_points.at(1) + main_points.at(2))/3 );
-                    std::vector<point>::iterator it = find(vp.begin(), vp.end(), p);
-                    if (it == vp.end())
-                    {
-                        vp.push_back(p);
-                        ve.at(edges.at(i)).points.push_back(vp.size()-1);
-                    }
-                    else
-                    {
-                        ve.at(edges.at(i)).points.push_back(std::distance(vp.begin(), it));
-                    }
+                    ve.at(edges.at(i)).points.push_back(vp_index.find_or_add(vp, p));
                 }
             }
+            std::unordered_map<int, int> local;
+            get_local_indices(local);
             for (int i = 0; i < f.points.size(); i++)
             {
                 point p = project(vp.at(f.points.at(i)), dif, normal, (main_points.at(0) + main_points.at(1) + main_points.at(2))/3 );
-                std::vector<point>::iterator it = find(vp.begin(), vp.end(), p);
-                if (it == vp.end())
+                int pi = vp_index.find(vp, p);
+                if (pi == -1)
                 {
-                    vp.push_back(p);
-                    points.push_back(vp.size()-1);
+                    pi = vp_index.add(vp, p);
+                    local.insert(std::make_pair(pi, int(points.size())));
+                    points.push_back(pi);
                 }
                 else
                 {
-                    if (find(points.begin(), points.end(), std::distance(vp.begin(), it)) == points.end())
-                        points.push_back(std::distance(vp.begin(), it));
+                    if (local.insert(std::make_pair(pi, int(points.size()))).second)
+                        points.push_back(pi);
                 }
             }
             for (int i = 0; i < f.trifacets.size(); i++)
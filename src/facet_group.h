@@ -0,0 +1,228 @@
+/*****************************************************************************
+* name: facet_group.h
+*
+* author: Biryukov V. biryukov.vova@gmail.com
+*
+* desc: Connected coplanar facets triangulated by a single Triangle call
+*
+* license: GPLv3
+*
+*****************************************************************************/
+
+#pragma once
+#include <vector>
+#include <cmath>
+#include <unordered_map>
+#include <unordered_set>
+#include "point.h"
+#include "edge.h"
+#include "facet.h"
+#include "settings.h"
+namespace swift
+{
+    // A group of one facet is triangulated as before. A larger group is
+    // triangulated as the polygon bounded by the edges its members do not
+    // share, and every triangle goes back to the member holding its centroid.
+    struct facet_group
+    {
+        std::vector<int> members;
+        facet boundary;
+        std::vector<int> owners;
+
+        facet_group() : boundary(std::vector<int>()) {}
+
+        // Discretizes the group border and collects its points. Edges
+        // must already be registered in the members' edge lists.
+        void set_boundary_points( std::vector< point > & vp, std::vector< facet > & vf, std::vector< edge > & ve, const std::vector<char> & is_inner_edge, REAL av_step )
+        {
+            if (members.size() == 1)
+            {
+                vf.at(members[0]).add_edge_points(vp, ve, av_step);
+                return;
+            }
+            // Corners go first, the first member's ones giving the plane basis
+            std::unordered_set<int> corners;
+            for (unsigned int i = 0; i < members.size(); i++)
+            {
+                const facet & f = vf.at(members[i]);
+                for (unsigned int j = 0; j < f.points.size(); j++)
+                    if (corners.insert(f.points[j]).second)
+                        boundary.points.push_back(f.points[j]);
+            }
+            for (unsigned int i = 0; i < members.size(); i++)
+            {
+                const facet & f = vf.at(members[i]);
+                for (unsigned int j = 0; j < f.edges.size(); j++)
+                    if (!is_inner_edge[f.edges[j]])
+                        boundary.edges.push_back(f.edges[j]);
+            }
+            boundary.add_edge_points(vp, ve, av_step);
+        }
+
+        // Writes to the members only, so groups may be triangulated concurrently
+        void triangulate( const std::vector< point > & vp, std::vector< facet > & vf, const std::vector< edge > & ve, REAL av_step )
+        {
+            if (members.size() == 1)
+            {
+                vf.at(members[0]).triangulate_boundary(vp, ve, av_step);
+                return;
+            }
+            boundary.triangulate_boundary(vp, ve, av_step);
+            set_owners(vp, vf);
+        }
+
+        void merge_triangulation( std::vector< point > & vp, std::vector< trifacet > & vt, std::vector< facet > & vf )
+        {
+            if (members.size() == 1)
+            {
+                vf.at(members[0]).merge_triangulation(vp, vt);
+                return;
+            }
+            for (unsigned int i = 0; i < boundary.interior_points.size(); i++)
+            {
+                vp.push_back(boundary.interior_points[i]);
+                boundary.points.push_back(vp.size()-1);
+            }
+            std::vector< point >().swap(boundary.interior_points);
+
+            std::vector< std::unordered_map<int, int> > local(members.size());
+            for (unsigned int i = 0; i < members.size(); i++)
+                vf.at(members[i]).get_local_indices(local[i]);
+            for (unsigned int i = 0; i < boundary.full_trifacets.size(); i++)
+            {
+                int m = owners[i];
+                facet & f = vf.at(members[m]);
+                int global[3], own[3];
+                for (int k = 0; k < 3; k++)
+                {
+                    global[k] = boundary.points[boundary.full_trifacets[i].points[k]];
+                    std::pair<std::unordered_map<int, int>::iterator, bool> it = local[m].insert(std::make_pair(global[k], int(f.points.size())));
+                    if (it.second)
+                        f.points.push_back(global[k]);
+                    own[k] = it.first->second;
+                }
+                vt.push_back(trifacet(global[0], global[1], global[2]));
+                f.trifacets.push_back(vt.size()-1);
+                f.full_trifacets.push_back(trifacet(own[0], own[1], own[2]));
+            }
+            std::vector< int >().swap(owners);
+        }
+
+    private:
+        // Finds the member containing each triangle centroid with a uniform
+        // grid over the members' bounding boxes in the plane of the group
+        void set_owners( const std::vector< point > & vp, const std::vector< facet > & vf )
+        {
+            point normal, p0;
+            boundary.get_plane_basis(vp, normal, p0);
+
+            std::vector< std::vector<REAL> > polygons(members.size());
+            REAL lo[2] = {HUGE_VAL, HUGE_VAL}, hi[2] = {-HUGE_VAL, -HUGE_VAL};
+            std::vector<REAL> boxes(4 * members.size());
+            for (unsigned int i = 0; i < members.size(); i++)
+            {
+                const facet & f = vf.at(members[i]);
+                REAL * b = &boxes[4*i];
+                b[0] = b[1] = HUGE_VAL;
+                b[2] = b[3] = -HUGE_VAL;
+                for (unsigned int j = 0; j < f.points.size(); j++)
+                {
+                    REAL c[2] = {vp.at(f.points[j]).projx(normal, p0), vp.at(f.points[j]).projy(normal, p0)};
+                    for (int d = 0; d < 2; d++)
+                    {
+                        polygons[i].push_back(c[d]);
+                        b[d] = std::min(b[d], c[d]);
+                        b[2+d] = std::max(b[2+d], c[d]);
+                    }
+                }
+                for (int d = 0; d < 2; d++)
+                {
+                    lo[d] = std::min(lo[d], b[d]);
+                    hi[d] = std::max(hi[d], b[2+d]);
+                }
+            }
+
+            int n = int(ceil(sqrt(REAL(members.size()))));
+            REAL size[2] = {(hi[0] - lo[0]) / n, (hi[1] - lo[1]) / n};
+            std::vector< std::vector<int> > cells(n * n);
+            for (unsigned int i = 0; i < members.size(); i++)
+            {
+                const REAL * b = &boxes[4*i];
+                int c0[2], c1[2];
+                for (int d = 0; d < 2; d++)
+                {
+                    c0[d] = get_cell(b[d], lo[d], size[d], n);
+                    c1[d] = get_cell(b[2+d], lo[d], size[d], n);
+                }
+                for (int x = c0[0]; x <= c1[0]; x++)
+                    for (int y = c0[1]; y <= c1[1]; y++)
+                        cells[x * n + y].push_back(i);
+            }
+
+            owners.resize(boundary.full_trifacets.size());
+            for (unsigned int i = 0; i < boundary.full_trifacets.size(); i++)
+            {
+                point c(0, 0, 0);
+                for (int k = 0; k < 3; k++)
+                {
+                    int p = boundary.full_trifacets[i].points[k];
+                    c = c + ((p < int(boundary.points.size())) ? vp.at(boundary.points[p]) : boundary.interior_points.at(p - boundary.points.size()));
+                }
+                c = c / 3;
+                REAL x = c.projx(normal, p0), y = c.projy(normal, p0);
+                const std::vector<int> & cell = cells[get_cell(x, lo[0], size[0], n) * n + get_cell(y, lo[1], size[1], n)];
+
+                // A centroid on a member border (up to round-off) goes to the nearest member
+                int best = -1;
+                REAL best_dist = HUGE_VAL;
+                for (unsigned int j = 0; j < cell.size() && best_dist > 0; j++)
+                {
+                    REAL dist = get_distance(polygons[cell[j]], x, y);
+                    if (dist < best_dist)
+                    {
+                        best = cell[j];
+                        best_dist = dist;
+                    }
+                }
+                for (unsigned int j = 0; best == -1 && j < members.size(); j++)
+                {
+                    REAL dist = get_distance(polygons[j], x, y);
+                    if (dist < best_dist)
+                    {
+                        best = j;
+                        best_dist = dist;
+                    }
+                }
+                owners[i] = best;
+            }
+        }
+
+        static int get_cell( REAL x, REAL lo, REAL size, int n )
+        {
+            int c = (size > 0) ? int((x - lo) / size) : 0;
+            return (c < 0) ? 0 : ((c >= n) ? n - 1 : c);
+        }
+
+        // Zero inside the polygon, the distance to its border outside
+        static REAL get_distance( const std::vector<REAL> & polygon, REAL x, REAL y )
+        {
+            bool inside = false;
+            REAL dist = HUGE_VAL;
+            int n = polygon.size() / 2;
+            for (int i = 0, j = n - 1; i < n; j = i++)
+            {
+                REAL xi = polygon[2*i], yi = polygon[2*i+1];
+                REAL xj = polygon[2*j], yj = polygon[2*j+1];
+                if ((yi > y) != (yj > y) && x < (xj - xi) * (y - yi) / (yj - yi) + xi)
+                    inside = !inside;
+                REAL dx = xj - xi, dy = yj - yi;
+                REAL len = dx * dx + dy * dy;
+                REAL t = (len > 0) ? ((x - xi) * dx + (y - yi) * dy) / len : 0;
+                t = std::max(REAL(0), std::min(REAL(1), t));
+                REAL ex = xi + t * dx - x, ey = yi + t * dy - y;
+                dist = std::min(dist, sqrt(ex * ex + ey * ey));
+            }
+            return inside ? 0 : dist;
+        }
+    };
+}
@@ -13,9 +13,15 @@
 #include <vector>
 #include <sstream>
 #include <fstream>
+#include <cmath>
+#include <unordered_set>
 #include "point.h"
 #include "edge.h"
 #include "facet.h"
+#include "facet_group.h"
+#include "edge_index.h"
+#include "point_index.h"
+#include "parallel.h"
 #include "settings.h"
 
 namespace swift
@@ -38,26 +44,42 @@ namespace swift
         std::vector<std::vector<int> > contacts;
 
         std::vector<trifacet> trifacets;
+        point_index points_index;
+        edge_index edges_index;
 
         bool is_empty;
+        bool merge_coplanar_facets;
+        bool is_final_surface;
         point hole;
         REAL av_step;
         REAL (*constraints)(REAL, REAL, REAL);
 
         point pos;
         struct {REAL alpha, beta, gamma;} ang;
+        REAL rotation[3][3];
 
-        figure(){};
+        figure() { merge_coplanar_facets = false; is_final_surface = false; };
         figure(std::string path, REAL av_step_t, REAL (*constraints_t)(REAL, REAL, REAL) = 0);
         figure(std::vector<point> & tpoints, std::vector<edge> & tedges, std::vector<facet> & tfacets, REAL av_step_t, point hole_t);
-        void make_triangulation();
+        // Figures are owned through base pointers by the mesh
+        virtual ~figure() {}
+        void make_triangulation(int threads_count = 0);
         virtual void read_from_file(std::string path);
+        virtual void get_input_files(std::vector<std::string> & files);
         virtual void set_data() = 0;
         virtual void set_boundaries_and_contacts(const std::vector<boundary_face> & boundaries, const std::vector<contact_face> & contacts, std::vector<unsigned int> & boundaryFacesCount, std::vector<unsigned int> & contactFacesCount) = 0;
+        void release_surface();
         void set_edges_by_facets();
+        void set_transform();
         point get_transformed_point(int i);
         point transform(point p);
+        void transform_points(REAL * pointlist) const;
         std::vector<int> get_non_contact_facets();
+        void set_facet_groups(const std::vector<int> & v, std::vector<facet_group> & groups, std::vector<char> & is_inner_edge);
+        bool is_coplanar(int f1, int f2);
+    private:
+        figure(const figure &);
+        figure & operator=(const figure &);
     };
 
 
@@ -71,6 +93,8 @@ namespace swift
 
     figure::figure(std::vector<point> & tpoints, std::vector<edge> & tedges, std::vector<facet> & tfacets, REAL av_step_t, point hole_t = point(0, 0, 0))
     {
+        merge_coplanar_facets = false;
+        is_final_surface = false;
         av_step = av_step_t;
         points = tpoints;
         edges = tedges;
@@ -81,7 +105,7 @@ namespace swift
     //void figure::set_boundaries_and_contacts(const std::vector<boundary_face> & boundaries, const std::vector<contact_face> & contacts, std::vector<unsigned int> & boundaryFacesCount, std::vector<unsigned int> & contactFacesCount){};
 
 
-    void figure::make_triangulation()
+    void figure::make_triangulation(int threads_count)
     {
         set_edges_by_facets();
         std::vector<int> v = get_non_contact_facets();
@@ -89,15 +113,163 @@ namespace swift
         {
             std::cout << "Triangulating contact facet " << i+1 << " from " << contacts.size() <<std::endl;
             std::vector<int> c = contacts.at(i);
-            facets.at(c.at(0)).make_triangulation(points, trifacets, edges, av_step);
-            //facets.at(c.at(1)).make_triangulation(points, trifacets, edges, av_step);
-            facets.at(c.at(1)).take_triangulation(points, trifacets, edges, facets.at(c.at(0)));
+            facets.at(c.at(0)).make_triangulation(points, trifacets, edges, edges_index, av_step);
+            //facets.at(c.at(1)).make_triangulation(points, trifacets, edges, edges_index, av_step);
+            facets.at(c.at(1)).take_triangulation(points, trifacets, edges, facets.at(c.at(0)), points_index, edges_index);
+        }
+        // A final surface keeps the edges left by the contacts undivided,
+        // so its triangles pass through without Triangle
+        if (is_final_surface)
+            for ( unsigned int i = 0; i < edges.size(); i++ )
+                if (edges[i].points.empty())
+                {
+                    edges[i].points.push_back(edges[i].start_point);
+                    edges[i].points.push_back(edges[i].finish_point);
+                }
+        // Edges are discretized first, so that the Triangle calls do not touch
+        // shared data and can run in parallel. Their results are merged in
+        // facet order, which keeps the output independent of threads_count.
+        std::vector<facet_group> groups;
+        std::vector<char> is_inner_edge;
+        set_facet_groups(v, groups, is_inner_edge);
+        for ( unsigned int i = 0; i < groups.size(); i++ )
+            groups[i].set_boundary_points(points, facets, edges, is_inner_edge, av_step);
+        std::cout << "Triangulating " << v.size() << " facets in " << groups.size() << " groups" <<std::endl;
+        parallel_for(groups.size(), threads_count, [this, &groups](int i)
+        {
+            groups[i].triangulate(points, facets, edges, av_step);
+        });
+        for ( unsigned int i = 0; i < groups.size(); i++ )
+            groups[i].merge_triangulation(points, trifacets, facets);
+    }
+
+    inline int find_root(std::vector<int> & parent, int i)
+    {
+        while (parent[i] != i)
+            i = parent[i] = parent[parent[i]];
+        return i;
+    }
+
+    // Registers the edges of the facets in v and splits them into groups
+    // ordered by their first facet. With merge_coplanar_facets, facets sharing
+    // an edge with no third facet on it are joined when they are coplanar;
+    // a group that would not be simply connected falls back to single facets.
+    void figure::set_facet_groups(const std::vector<int> & v, std::vector<facet_group> & groups, std::vector<char> & is_inner_edge)
+    {
+        for ( unsigned int i = 0; i < v.size(); i++ )
+            facets.at(v.at(i)).add_edges_by_points(edges, edges_index);
+        is_inner_edge.assign(edges.size(), 0);
+        std::vector<int> group(facets.size(), -1);
+        if (!merge_coplanar_facets)
+        {
+            for ( unsigned int i = 0; i < v.size(); i++ )
+            {
+                groups.push_back(facet_group());
+                groups.back().members.push_back(v[i]);
+            }
+            return;
+        }
+
+        // Facets using each edge, -1 for contact facets
+        std::vector<int> users_count(edges.size(), 0);
+        std::vector<int> users(2 * edges.size(), -1);
+        std::vector<char> is_free(facets.size(), 0);
+        for ( unsigned int i = 0; i < v.size(); i++ )
+            is_free[v[i]] = 1;
+        for ( unsigned int i = 0; i < facets.size(); i++ )
+            for ( unsigned int j = 0; j < facets[i].edges.size(); j++ )
+            {
+                int e = facets[i].edges[j];
+                if (users_count[e] < 2)
+                    users[2*e + users_count[e]] = is_free[i] ? int(i) : -1;
+                users_count[e]++;
+            }
+
+        // Union-find over facets, the root being the lowest facet
+        std::vector<int> parent(facets.size());
+        for ( unsigned int i = 0; i < facets.size(); i++ )
+            parent[i] = i;
+        for ( unsigned int e = 0; e < edges.size(); e++ )
+        {
+            int f1 = users[2*e], f2 = users[2*e + 1];
+            if (users_count[e] != 2 || f1 == -1 || f2 == -1 || f1 == f2 || !is_coplanar(f1, f2))
+                continue;
+            f1 = find_root(parent, f1);
+            f2 = find_root(parent, f2);
+            if (f1 != f2)
+                parent[std::max(f1, f2)] = std::min(f1, f2);
         }
         for ( unsigned int i = 0; i < v.size(); i++ )
         {
-            std::cout << "Triangulating facet " << i+1 << " from " << v.size() <<std::endl;
-            facets.at(v.at(i)).make_triangulation(points, trifacets, edges, av_step);
+            int r = find_root(parent, v[i]);
+            if (group[r] == -1)
+            {
+                group[r] = groups.size();
+                groups.push_back(facet_group());
+            }
+            group[v[i]] = group[r];
+            groups[group[r]].members.push_back(v[i]);
         }
+
+        // V - E + F is 1 for a disk, border points must have two border edges
+        std::vector<facet_group> result;
+        std::vector<int> degree(points.size(), 0);
+        for ( unsigned int g = 0; g < groups.size(); g++ )
+        {
+            const std::vector<int> & m = groups[g].members;
+            bool is_disk = true;
+            if (m.size() > 1)
+            {
+                std::unordered_set<int> vertices, group_edges;
+                for ( unsigned int i = 0; i < m.size(); i++ )
+                {
+                    vertices.insert(facets[m[i]].points.begin(), facets[m[i]].points.end());
+                    group_edges.insert(facets[m[i]].edges.begin(), facets[m[i]].edges.end());
+                }
+                is_disk = (int(vertices.size()) - int(group_edges.size()) + int(m.size()) == 1);
+                for (std::unordered_set<int>::iterator e = group_edges.begin(); e != group_edges.end(); e++)
+                    if (users_count[*e] == 2 && users[2 * *e] != -1 && users[2 * *e + 1] != -1 && group[users[2 * *e]] == group[users[2 * *e + 1]])
+                        is_inner_edge[*e] = 1;
+                    else
+                    {
+                        degree[edges[*e].start_point]++;
+                        degree[edges[*e].finish_point]++;
+                    }
+                for (std::unordered_set<int>::iterator p = vertices.begin(); p != vertices.end(); p++)
+                {
+                    if (degree[*p] != 0 && degree[*p] != 2)
+                        is_disk = false;
+                    degree[*p] = 0;
+                }
+                if (!is_disk)
+                    for (std::unordered_set<int>::iterator e = group_edges.begin(); e != group_edges.end(); e++)
+                        is_inner_edge[*e] = 0;
+            }
+            if (is_disk)
+                result.push_back(groups[g]);
+            else
+                for ( unsigned int i = 0; i < m.size(); i++ )
+                {
+                    result.push_back(facet_group());
+                    result.back().members.push_back(m[i]);
+                }
+        }
+        groups.swap(result);
+    }
+
+    // Compares the planes through the first three points of the facets
+    bool figure::is_coplanar(int f1, int f2)
+    {
+        const REAL tolerance = 1e-6;
+        point n1, n2, x;
+        facets[f1].get_plane_basis(points, n1, x);
+        facets[f2].get_plane_basis(points, n2, x);
+        if (!(n1.vec(n2).norm() <= tolerance))
+            return false;
+        for ( unsigned int i = 0; i < facets[f2].points.size(); i++ )
+            if (!(fabs(n1.dot(points[facets[f2].points[i]] - points[facets[f1].points[0]])) <= tolerance * av_step))
+                return false;
+        return true;
     }
 
     void figure::set_edges_by_facets()
@@ -105,26 +277,60 @@ namespace swift
         for ( unsigned int i = 0; i < facets.size(); i++ )
         {
             std::cout << "Setting facet " << i+1 << " from " << facets.size() <<std::endl;
-            facet f = facets.at(i);
+            const facet & f = facets.at(i);
             for (std::vector<int>::size_type i = 0; i < f.points.size(); i++)
             {
-                edge e = edge(f.points.at(i), f.points.at((i+1) % f.points.size()));
-                if (std::find(edges.begin(), edges.end(), e) == edges.end())
-                {
-                    edges.push_back(e);
-                    f.edges.push_back(edges.size()-1);
-                }
+                edges_index.find_or_add(edges, f.points.at(i), f.points.at((i+1) % f.points.size()));
             }
         }
     }
 
+    // Caches the matrix of point::rotate for the current angles,
+    // must be called again whenever ang changes
+    void figure::set_transform()
+    {
+        REAL a = ang.alpha, b = ang.beta, g = ang.gamma;
+        rotation[0][0] = cos(a)*cos(g)-sin(a)*cos(b)*sin(g);
+        rotation[0][1] = -cos(a)*sin(g)-sin(a)*cos(b)*cos(g);
+        rotation[0][2] = sin(a)*sin(b);
+        rotation[1][0] = sin(a)*cos(g)+cos(a)*cos(b)*sin(g);
+        rotation[1][1] = -sin(a)*sin(g)+cos(a)*cos(b)*cos(g);
+        rotation[1][2] = -cos(a)*sin(b);
+        rotation[2][0] = sin(b)*sin(g);
+        rotation[2][1] = sin(b)*cos(g);
+        rotation[2][2] = cos(b);
+    }
+
     point figure::get_transformed_point(int i)
     {
-        return pos + points[i].rotate(ang.alpha, ang.beta, ang.gamma);
+        return transform(points[i]);
     }
     point figure::transform(point p)
     {
-        return pos + p.rotate(ang.alpha, ang.beta, ang.gamma);
+        const REAL (*r)[3] = rotation;
+        return pos + point(r[0][0]*p.x + r[0][1]*p.y + r[0][2]*p.z,
+                           r[1][0]*p.x + r[1][1]*p.y + r[1][2]*p.z,
+                           r[2][0]*p.x + r[2][1]*p.y + r[2][2]*p.z);
+    }
+
+    // Writes all transformed points to pointlist as x, y, z triples. The
+    // coefficients are copied to locals, so the loop does not reload them
+    // through the output pointer and the compiler can vectorize it.
+    void figure::transform_points(REAL * pointlist) const
+    {
+        const REAL r00 = rotation[0][0], r01 = rotation[0][1], r02 = rotation[0][2];
+        const REAL r10 = rotation[1][0], r11 = rotation[1][1], r12 = rotation[1][2];
+        const REAL r20 = rotation[2][0], r21 = rotation[2][1], r22 = rotation[2][2];
+        const REAL px = pos.x, py = pos.y, pz = pos.z;
+        const int n = points.size();
+        const point * p = points.empty() ? (const point *) NULL : &points[0];
+        for (int i = 0; i < n; i++)
+        {
+            const REAL x = p[i].x, y = p[i].y, z = p[i].z;
+            pointlist[3*i + 0] = px + (r00*x + r01*y + r02*z);
+            pointlist[3*i + 1] = py + (r10*x + r11*y + r12*z);
+            pointlist[3*i + 2] = pz + (r20*x + r21*y + r22*z);
+        }
     }
 
     std::vector<int> figure::get_non_contact_facets()
@@ -139,6 +345,23 @@ namespace swift
         return result;
     }
 
+    // Appends the files besides the config the figure is read from
+    void figure::get_input_files(std::vector<std::string> & files)
+    {
+    }
+
+    // Frees the surface once it is copied into the tetgen input
+    void figure::release_surface()
+    {
+        std::vector<point>().swap(points);
+        std::vector<edge>().swap(edges);
+        std::vector<facet>().swap(facets);
+        std::vector<std::vector<int> >().swap(contacts);
+        std::vector<trifacet>().swap(trifacets);
+        points_index.release();
+        edges_index.release();
+    }
+
     void figure::read_from_file(std::string path)
     {
         std::ifstream file;
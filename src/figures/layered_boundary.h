@@ -13,6 +13,7 @@
 
 #include "../figure.h"
 #include "../facet.h"
+#include "../triangle_workspace.h"
 #include <sstream>
 #include "../profile/Profile.h"
 #include <fstream>
@@ -44,6 +45,7 @@ namespace swift
             set_data();
         }
         virtual void read_from_file(std::string path);
+        virtual void get_input_files(std::vector<std::string> & files);
         virtual void set_data();
         virtual void set_boundaries_and_contacts(const std::vector<boundary_face> & boundaries, const std::vector<contact_face> & contacts, std::vector<unsigned int> & boundaryFacesCount, std::vector<unsigned int> & contactFacesCount);
 
@@ -121,137 +123,36 @@ namespace swift
 
     void layered_boundary::basic_triangulate()
     {
-        struct triangulateio in, out;
-        // Setting triangulateio in and out:
-
-        in.pointlist = (REAL*)(NULL);
-        in.pointattributelist = (REAL*)(NULL);
-        in.pointmarkerlist = (int*)(NULL);
-        in.numberofpoints = 0;
-        in.numberofpointattributes = 0;
-
-        in.trianglelist = (int*)(NULL);
-        in.triangleattributelist = (REAL*)(NULL);
-        in.trianglearealist = (REAL*)(NULL);
-        in.neighborlist = (int*)(NULL);
-        in.numberoftriangles = 0;
-        in.numberofcorners = 0;
-        in.numberoftriangleattributes = 0;
-
-        in.segmentlist = (int*)(NULL);
-        in.segmentmarkerlist = (int*)(NULL);
-        in.numberofsegments = 0;
-
-        in.holelist = (REAL*)(NULL);
-        in.numberofholes = 0;
-
-        in.regionlist = (REAL*)(NULL);
-        in.numberofregions = 0;
-
-        in.edgelist = (int*)(NULL);
-        in.edgemarkerlist = (int*)(NULL);
-        in.normlist = (REAL*)(NULL);
-        in.numberofedges = 0;
-
-        in.numberofpoints = boundary_points.size();
-        in.numberofpointattributes = 0;
-        in.pointlist = (REAL *) malloc(in.numberofpoints * 2 * sizeof(REAL));
-        in.pointmarkerlist = (int *) NULL;
-        in.pointattributelist = (REAL *) NULL;
-
-        for (int i = 0; i < in.numberofpoints; i++)
+        triangle_workspace & ws = triangle_workspace::local();
+        ws.set_input(boundary_points.size(), boundary_points.size());
+
+        for (int i = 0; i < ws.in.numberofpoints; i++)
         {
-            in.pointlist[2*i + 0] = boundary_points[i].x;
-            in.pointlist[2*i + 1] = boundary_points[i].y;
+            ws.in.pointlist[2*i + 0] = boundary_points[i].x;
+            ws.in.pointlist[2*i + 1] = boundary_points[i].y;
         }
 
-        in.numberofsegments = in.numberofpoints;
-        in.segmentlist = (int *) malloc(in.numberofsegments * 2 * sizeof(int));
-        in.segmentmarkerlist = (int *) NULL;
-        for (int i = 0; i < in.numberofsegments; i++)
+        for (int i = 0; i < ws.in.numberofsegments; i++)
         {
-            in.segmentlist[2*i] = i;
-            in.segmentlist[2*i+1] = i+1;
+            ws.in.segmentlist[2*i] = i;
+            ws.in.segmentlist[2*i+1] = i+1;
         }
-        in.segmentlist[2*in.numberofsegments-1] = 0;
-
-        out.pointlist = (REAL*)(NULL);
-        out.pointattributelist = (REAL*)(NULL);
-        out.pointmarkerlist = (int*)(NULL);
-        out.numberofpoints = 0;
-        out.numberofpointattributes = 0;
-
-        out.trianglelist = (int*)(NULL);
-        out.triangleattributelist = (REAL*)(NULL);
-        out.trianglearealist = (REAL*)(NULL);
-        out.neighborlist = (int*)(NULL);
-        out.numberoftriangles = 0;
-        out.numberofcorners = 0;
-        out.numberoftriangleattributes = 0;
-
-        out.segmentlist = (int*)(NULL);
-        out.segmentmarkerlist = (int*)(NULL);
-        out.numberofsegments = 0;
-
-        out.holelist = (REAL*)(NULL);
-        out.numberofholes = 0;
-
-        out.regionlist = (REAL*)(NULL);
-        out.numberofregions = 0;
-
-        out.edgelist = (int*)(NULL);
-        out.edgemarkerlist = (int*)(NULL);
-        out.normlist = (REAL*)(NULL);
-        out.numberofedges = 0;
-
-        std::stringstream ss5;
-        ss5 << "pzqYQa" << discretization_step * discretization_step / 2;
-        std::string str;
-        ss5 >> str;
-        char * s = new char[str.size() + 1];
-        std::copy(str.begin(), str.end(), s);
-        s[str.size()] = '\0';
-        triangulate(s, &in, &out, (struct triangulateio *) NULL);
-
-
-        for (int i = 0; i < out.numberofpoints; i++)
+        ws.in.segmentlist[2*ws.in.numberofsegments-1] = 0;
+
+        ws.set_switches("pzqYQa", discretization_step * discretization_step / 2);
+        ws.triangulate();
+
+
+        for (int i = 0; i < ws.out.numberofpoints; i++)
         {
-            xy_points.push_back(point(out.pointlist[2*i], out.pointlist[2*i+1], 0.0));
+            xy_points.push_back(point(ws.out.pointlist[2*i], ws.out.pointlist[2*i+1], 0.0));
         }
 
-        for (int i = 0; i < out.numberoftriangles; i++)
+        for (int i = 0; i < ws.out.numberoftriangles; i++)
         {
-            xy_trifacets.push_back(trifacet(out.trianglelist[3*i], out.trianglelist[3*i+1], out.trianglelist[3*i+2]));
+            xy_trifacets.push_back(trifacet(ws.out.trianglelist[3*i], ws.out.trianglelist[3*i+1], ws.out.trianglelist[3*i+2]));
         }
-
-
-        if (in.pointlist)             free(in.pointlist);
-        if (in.pointattributelist)    free(in.pointattributelist);
-        if (in.pointmarkerlist)       free(in.pointmarkerlist);
-        if (in.trianglelist)          free(in.trianglelist);
-        if (in.triangleattributelist) free(in.triangleattributelist);
-        if (in.trianglearealist)      free(in.trianglearealist);
-        if (in.neighborlist)          free(in.neighborlist);
-        if (in.segmentlist)           free(in.segmentlist);
-        if (in.segmentmarkerlist)     free(in.segmentmarkerlist);
-        if (in.regionlist)            free(in.regionlist);
-        if (in.edgelist)              free(in.edgelist);
-        if (in.edgemarkerlist)        free(in.edgemarkerlist);
-        if (in.normlist)              free(in.normlist);
-
-        if (out.pointlist)             free(out.pointlist);
-        if (out.pointattributelist)    free(out.pointattributelist);
-        if (out.pointmarkerlist)       free(out.pointmarkerlist);
-        if (out.trianglelist)          free(out.trianglelist);
-        if (out.triangleattributelist) free(out.triangleattributelist);
-        if (out.trianglearealist)      free(out.trianglearealist);
-        if (out.neighborlist)          free(out.neighborlist);
-        if (out.segmentlist)           free(out.segmentlist);
-        if (out.segmentmarkerlist)     free(out.segmentmarkerlist);
-        if (out.regionlist)            free(out.regionlist);
-        if (out.edgelist)              free(out.edgelist);
-        if (out.edgemarkerlist)        free(out.edgemarkerlist);
-        if (out.normlist)              free(out.normlist);
+        ws.release_output();
     }
 
     bool ReplaceSubstring(std::string& str, const std::string& from, const std::string& to)
@@ -263,6 +164,19 @@ namespace swift
         return true;
     }
 
+    void layered_boundary::get_input_files(std::vector<std::string> & files)
+    {
+        files.push_back(xy_boundary_path);
+        for (int i = 1; i <= number_of_layers; i++)
+        {
+            std::stringstream ss;
+            ss << i;
+            std::string path = layer_path;
+            ReplaceSubstring(path, "<index>", ss.str());
+            files.push_back(path);
+        }
+    }
+
     void layered_boundary::read_layer(int nun_of_layer, std::vector<point> & layer)
     {
         layer.resize(0);
@@ -296,7 +210,7 @@ namespace swift
     };
     struct cell_compare
     {
-       bool operator() (const cell& lhs, const cell& rhs)
+       bool operator() (const cell& lhs, const cell& rhs) const
        {
            return (lhs.x < rhs.x) || (lhs.x == rhs.x && lhs.y < rhs.y);
        }
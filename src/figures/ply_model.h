@@ -28,10 +28,16 @@ namespace swift
             set_data();
         }
         virtual void read_from_file(std::string path);
+        virtual void get_input_files(std::vector<std::string> & files);
         virtual void set_data();
         virtual void set_boundaries_and_contacts(const std::vector<boundary_face> & boundaries, const std::vector<contact_face> & contacts, std::vector<unsigned int> & boundaryFacesCount, std::vector<unsigned int> & contactFacesCount);
     };
 
+    void ply_model::get_input_files(std::vector<std::string> & files)
+    {
+        files.push_back(path_to_model);
+    }
+
     void ply_model::read_from_file(std::string path)
     {
         using std::string;
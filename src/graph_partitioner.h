@@ -0,0 +1,468 @@
+/*****************************************************************************
+* name: graph_partitioner.h
+*
+* author: Biryukov V. biryukov.vova@gmail.com
+*
+* desc: Multilevel partitioner of the face adjacency graph of the cells
+*
+* license: GPLv3
+*
+*****************************************************************************/
+
+#pragma once
+#include <vector>
+#include <deque>
+#include <queue>
+#include <utility>
+#include <algorithm>
+#include "partitioner.h"
+#include "parallel.h"
+#include "settings.h"
+namespace swift
+{
+    // Weighted graph in compressed rows: the neighbours of u are
+    // adjncy[xadj[u]] ... adjncy[xadj[u+1]-1]
+    struct dual_graph
+    {
+        std::vector<int_t> xadj, adjncy;
+        std::vector<int> adjwgt, vwgt;
+
+        int_t size() const
+        {
+            return int_t(vwgt.size());
+        }
+    };
+
+    // A face of a cell, its nodes sorted
+    struct cell_face
+    {
+        int_t nodes[3];
+        int_t cell;
+
+        bool operator<(const cell_face & f) const
+        {
+            for (int i = 0; i < 3; i++)
+                if (nodes[i] != f.nodes[i])
+                    return nodes[i] < f.nodes[i];
+            return cell < f.cell;
+        }
+
+        bool is_same(const cell_face & f) const
+        {
+            return nodes[0] == f.nodes[0] && nodes[1] == f.nodes[1] && nodes[2] == f.nodes[2];
+        }
+    };
+
+    // Cells sharing a face are neighbours. The faces of all cells are
+    // sorted, so the two copies of an inner face end up next to each other.
+    inline void build_dual_graph(const int * cells, int_t cells_count, int threads_count, dual_graph & g)
+    {
+        std::vector<cell_face> faces(4 * (unsigned long long)cells_count);
+        parallel_for(cells_count, threads_count, [&](int i)
+        {
+            for (int k = 0; k < 4; k++)
+            {
+                cell_face & f = faces[4*i + k];
+                int m = 0;
+                for (int j = 0; j < 4; j++)
+                    if (j != k)
+                        f.nodes[m++] = int_t(cells[4*i + j]);
+                std::sort(f.nodes, f.nodes + 3);
+                f.cell = i;
+            }
+        }, 4096);
+        parallel_sort(faces.begin(), faces.end(), std::less<cell_face>(), threads_count);
+
+        g.xadj.assign(cells_count + 1, 0);
+        for (unsigned long long i = 0; i + 1 < faces.size(); i++)
+            if (faces[i].is_same(faces[i+1]))
+            {
+                g.xadj[faces[i].cell + 1]++;
+                g.xadj[faces[i+1].cell + 1]++;
+                i++;
+            }
+        for (int_t i = 0; i < cells_count; i++)
+            g.xadj[i+1] += g.xadj[i];
+        std::vector<int_t> next(g.xadj.begin(), g.xadj.end() - 1);
+        g.adjncy.resize(g.xadj.back());
+        for (unsigned long long i = 0; i + 1 < faces.size(); i++)
+            if (faces[i].is_same(faces[i+1]))
+            {
+                g.adjncy[next[faces[i].cell]++] = faces[i+1].cell;
+                g.adjncy[next[faces[i+1].cell]++] = faces[i].cell;
+                i++;
+            }
+        g.adjwgt.assign(g.adjncy.size(), 1);
+        g.vwgt.assign(cells_count, 1);
+    }
+
+    // Multilevel recursive bisection of the dual graph: heavy edge matching
+    // coarsens the graph, the coarsest one is bisected by growing a region
+    // from a few seeds, and the bisection is refined by Fiduccia-Mattheyses
+    // passes on every level on the way back. Parts of the same recursion
+    // depth are bisected concurrently.
+    struct graph_partitioner : public partitioner
+    {
+        void partition(const std::vector<REAL> & centres, const int * cells, int_t parts_count, int threads_count, std::vector<int_t> & parts)
+        {
+            int_t cells_count = centres.size() / 3;
+            dual_graph g;
+            build_dual_graph(cells, cells_count, threads_count, g);
+            parts.assign(cells_count, 0);
+
+            // Position of every cell in its task, tasks of a level being disjoint
+            std::vector<int_t> local(cells_count), owner(cells_count);
+            std::vector<task> level(1);
+            level[0].vertices.resize(cells_count);
+            for (int_t i = 0; i < cells_count; i++)
+                level[0].vertices[i] = i;
+            level[0].first_part = 0;
+            level[0].parts_count = parts_count;
+            while (!level.empty())
+            {
+                for (unsigned int i = 0; i < level.size(); i++)
+                    for (unsigned int j = 0; j < level[i].vertices.size(); j++)
+                    {
+                        local[level[i].vertices[j]] = j;
+                        owner[level[i].vertices[j]] = i;
+                    }
+                std::vector<task> next(2 * level.size());
+                parallel_for(level.size(), threads_count, [&](int i)
+                {
+                    bisect_task(g, local, owner, i, level[i], next[2*i], next[2*i+1], parts);
+                });
+                level.clear();
+                for (unsigned int i = 0; i < next.size(); i++)
+                    if (next[i].parts_count > 0)
+                    {
+                        level.push_back(task());
+                        level.back().vertices.swap(next[i].vertices);
+                        level.back().first_part = next[i].first_part;
+                        level.back().parts_count = next[i].parts_count;
+                    }
+            }
+        }
+
+    private:
+        struct task
+        {
+            std::vector<int_t> vertices;
+            int_t first_part, parts_count;
+
+            task() : first_part(0), parts_count(0) {}
+        };
+
+        static void bisect_task(const dual_graph & g, const std::vector<int_t> & local, const std::vector<int_t> & owner, int_t id,
+                                const task & t, task & left, task & right, std::vector<int_t> & parts)
+        {
+            if (t.parts_count <= 1 || t.vertices.size() <= 1)
+            {
+                for (unsigned int i = 0; i < t.vertices.size(); i++)
+                    parts[t.vertices[i]] = t.first_part;
+                return;
+            }
+            dual_graph sub;
+            sub.xadj.push_back(0);
+            for (unsigned int i = 0; i < t.vertices.size(); i++)
+            {
+                int_t u = t.vertices[i];
+                for (int_t e = g.xadj[u]; e < g.xadj[u+1]; e++)
+                    if (owner[g.adjncy[e]] == id)
+                    {
+                        sub.adjncy.push_back(local[g.adjncy[e]]);
+                        sub.adjwgt.push_back(g.adjwgt[e]);
+                    }
+                sub.xadj.push_back(sub.adjncy.size());
+                sub.vwgt.push_back(g.vwgt[u]);
+            }
+            long long total = 0;
+            for (unsigned int i = 0; i < sub.vwgt.size(); i++)
+                total += sub.vwgt[i];
+            int_t left_parts = t.parts_count / 2;
+            long long target = total * left_parts / t.parts_count;
+            unsigned long long seed = 0x9E3779B97F4A7C15ULL ^ (t.first_part * 1000003ULL + t.parts_count);
+
+            std::vector<char> side;
+            bisect(sub, target, seed, side);
+
+            left.first_part = t.first_part;
+            left.parts_count = left_parts;
+            right.first_part = t.first_part + left_parts;
+            right.parts_count = t.parts_count - left_parts;
+            for (unsigned int i = 0; i < t.vertices.size(); i++)
+                (side[i] ? right : left).vertices.push_back(t.vertices[i]);
+        }
+
+        static unsigned int get_random(unsigned long long & seed)
+        {
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            return (unsigned int)(seed >> 33);
+        }
+
+        // Splits g into side 0 of weight close to target and side 1
+        static void bisect(const dual_graph & g, long long target, unsigned long long seed, std::vector<char> & side)
+        {
+            std::deque<dual_graph> levels;
+            std::deque< std::vector<int_t> > cmaps;
+            const dual_graph * fine = &g;
+            while (fine->size() > 100)
+            {
+                levels.push_back(dual_graph());
+                cmaps.push_back(std::vector<int_t>());
+                coarsen(*fine, seed, cmaps.back(), levels.back());
+                if (levels.back().size() > fine->size() * 0.95)
+                {
+                    levels.pop_back();
+                    cmaps.pop_back();
+                    break;
+                }
+                fine = &levels.back();
+            }
+
+            // Best of a few grown regions on the coarsest graph
+            long long best_cut = -1;
+            std::vector<char> trial;
+            for (int i = 0; i < 4; i++)
+            {
+                grow_region(*fine, get_random(seed) % fine->size(), target, trial);
+                refine(*fine, target, trial);
+                long long cut = get_cut(*fine, trial);
+                if (best_cut < 0 || cut < best_cut)
+                {
+                    best_cut = cut;
+                    side.swap(trial);
+                }
+            }
+
+            for (int l = int(levels.size()) - 1; l >= 0; l--)
+            {
+                const dual_graph & finer = (l == 0) ? g : levels[l-1];
+                trial.resize(finer.size());
+                for (int_t u = 0; u < finer.size(); u++)
+                    trial[u] = side[cmaps[l][u]];
+                side.swap(trial);
+                refine(finer, target, side);
+            }
+        }
+
+        // Matches every vertex with its unmatched neighbour over the
+        // heaviest edge, visiting them in random order, and merges the pairs
+        static void coarsen(const dual_graph & g, unsigned long long & seed, std::vector<int_t> & cmap, dual_graph & c)
+        {
+            const int_t none = int_t(-1);
+            int_t n = g.size();
+            std::vector<int_t> order(n);
+            for (int_t i = 0; i < n; i++)
+                order[i] = i;
+            for (int_t i = n; i > 1; i--)
+                std::swap(order[i-1], order[get_random(seed) % i]);
+
+            std::vector<int_t> match(n, none), first;
+            cmap.assign(n, none);
+            for (int_t i = 0; i < n; i++)
+            {
+                int_t u = order[i];
+                if (match[u] != none)
+                    continue;
+                int_t best = u;
+                int best_weight = 0;
+                for (int_t e = g.xadj[u]; e < g.xadj[u+1]; e++)
+                {
+                    int_t v = g.adjncy[e];
+                    if (match[v] == none && v != u && g.adjwgt[e] > best_weight)
+                    {
+                        best = v;
+                        best_weight = g.adjwgt[e];
+                    }
+                }
+                match[u] = best;
+                match[best] = u;
+                cmap[u] = cmap[best] = first.size();
+                first.push_back(u);
+            }
+
+            int_t cn = first.size();
+            c.xadj.assign(1, 0);
+            c.adjncy.clear();
+            c.adjwgt.clear();
+            c.vwgt.assign(cn, 0);
+            std::vector<int_t> position(cn, none);
+            for (int_t k = 0; k < cn; k++)
+            {
+                int_t start = c.adjncy.size();
+                int_t pair[2] = {first[k], match[first[k]]};
+                for (int m = 0; m < ((pair[0] == pair[1]) ? 1 : 2); m++)
+                {
+                    int_t u = pair[m];
+                    c.vwgt[k] += g.vwgt[u];
+                    for (int_t e = g.xadj[u]; e < g.xadj[u+1]; e++)
+                    {
+                        int_t ck = cmap[g.adjncy[e]];
+                        if (ck == k)
+                            continue;
+                        if (position[ck] == none || position[ck] < start)
+                        {
+                            position[ck] = c.adjncy.size();
+                            c.adjncy.push_back(ck);
+                            c.adjwgt.push_back(g.adjwgt[e]);
+                        }
+                        else
+                            c.adjwgt[position[ck]] += g.adjwgt[e];
+                    }
+                }
+                c.xadj.push_back(c.adjncy.size());
+            }
+        }
+
+        // Breadth first region of weight close to target around start,
+        // jumping to unvisited vertices when a component runs out
+        static void grow_region(const dual_graph & g, int_t start, long long target, std::vector<char> & side)
+        {
+            int_t n = g.size();
+            side.assign(n, 1);
+            std::vector<char> seen(n, 0);
+            std::vector<int_t> queue;
+            queue.reserve(n);
+            queue.push_back(start);
+            seen[start] = 1;
+            unsigned int head = 0;
+            int_t next_seed = 0;
+            long long weight = 0;
+            while (weight < target)
+            {
+                if (head == queue.size())
+                {
+                    while (next_seed < n && seen[next_seed])
+                        next_seed++;
+                    if (next_seed == n)
+                        break;
+                    queue.push_back(next_seed);
+                    seen[next_seed] = 1;
+                }
+                int_t u = queue[head++];
+                if (weight + g.vwgt[u] - target > target - weight)
+                    break;
+                side[u] = 0;
+                weight += g.vwgt[u];
+                for (int_t e = g.xadj[u]; e < g.xadj[u+1]; e++)
+                    if (!seen[g.adjncy[e]])
+                    {
+                        seen[g.adjncy[e]] = 1;
+                        queue.push_back(g.adjncy[e]);
+                    }
+            }
+        }
+
+        static long long get_cut(const dual_graph & g, const std::vector<char> & side)
+        {
+            long long cut = 0;
+            for (int_t u = 0; u < g.size(); u++)
+                for (int_t e = g.xadj[u]; e < g.xadj[u+1]; e++)
+                    if (side[u] != side[g.adjncy[e]])
+                        cut += g.adjwgt[e];
+            return cut / 2;
+        }
+
+        // Moves u to the other side, updating the side weights and the gains
+        // (cut decrease if moved) of u and its neighbours
+        static void move_vertex(const dual_graph & g, int_t u, std::vector<char> & side, std::vector<int> & gain, long long weight[2])
+        {
+            int s = side[u];
+            side[u] = char(1 - s);
+            weight[s] -= g.vwgt[u];
+            weight[1 - s] += g.vwgt[u];
+            gain[u] = -gain[u];
+            for (int_t e = g.xadj[u]; e < g.xadj[u+1]; e++)
+            {
+                int_t v = g.adjncy[e];
+                gain[v] += (side[v] == s) ? 2 * g.adjwgt[e] : -2 * g.adjwgt[e];
+            }
+        }
+
+        // Fiduccia-Mattheyses passes: the best gain vertex that keeps the
+        // sides within a 3% tolerance moves, and every pass is rolled back
+        // to its best balanced cut
+        static void refine(const dual_graph & g, long long target, std::vector<char> & side)
+        {
+            int_t n = g.size();
+            long long total = 0;
+            int max_vertex = 0;
+            for (int_t u = 0; u < n; u++)
+            {
+                total += g.vwgt[u];
+                max_vertex = std::max(max_vertex, g.vwgt[u]);
+            }
+            long long tolerance = std::max((long long)max_vertex, total * 3 / 200);
+            long long max_weight[2] = {target + tolerance, total - target + tolerance};
+
+            std::vector<int> gain(n, 0);
+            long long weight[2] = {0, 0};
+            for (int_t u = 0; u < n; u++)
+            {
+                weight[int(side[u])] += g.vwgt[u];
+                for (int_t e = g.xadj[u]; e < g.xadj[u+1]; e++)
+                    gain[u] += (side[g.adjncy[e]] != side[u]) ? g.adjwgt[e] : -g.adjwgt[e];
+            }
+
+            std::vector<char> locked(n);
+            std::vector<int_t> moves;
+            for (int pass = 0; pass < 8; pass++)
+            {
+                std::fill(locked.begin(), locked.end(), 0);
+                moves.clear();
+                std::priority_queue< std::pair<int, int_t> > heap;
+                for (int_t u = 0; u < n; u++)
+                    if (is_boundary(g, side, u))
+                        heap.push(std::make_pair(gain[u], u));
+
+                long long excess = get_excess(weight, max_weight);
+                long long best_excess = excess, cut_change = 0, best_cut_change = 0;
+                unsigned int best_moves = 0;
+                int_t limit = std::max(int_t(50), n / 100);
+                while (!heap.empty() && moves.size() - best_moves < limit)
+                {
+                    int_t u = heap.top().second;
+                    int u_gain = heap.top().first;
+                    heap.pop();
+                    if (locked[u] || u_gain != gain[u])
+                        continue;
+                    int s = side[u];
+                    if (weight[1 - s] + g.vwgt[u] > max_weight[1 - s] && weight[s] <= max_weight[s])
+                        continue;
+                    cut_change -= gain[u];
+                    move_vertex(g, u, side, gain, weight);
+                    locked[u] = 1;
+                    moves.push_back(u);
+                    for (int_t e = g.xadj[u]; e < g.xadj[u+1]; e++)
+                        if (!locked[g.adjncy[e]])
+                            heap.push(std::make_pair(gain[g.adjncy[e]], g.adjncy[e]));
+                    excess = get_excess(weight, max_weight);
+                    if (excess < best_excess || (excess == best_excess && cut_change < best_cut_change))
+                    {
+                        best_excess = excess;
+                        best_cut_change = cut_change;
+                        best_moves = moves.size();
+                    }
+                }
+                for (unsigned int i = moves.size(); i > best_moves; i--)
+                    move_vertex(g, moves[i-1], side, gain, weight);
+                if (best_moves == 0)
+                    break;
+            }
+        }
+
+        static bool is_boundary(const dual_graph & g, const std::vector<char> & side, int_t u)
+        {
+            for (int_t e = g.xadj[u]; e < g.xadj[u+1]; e++)
+                if (side[g.adjncy[e]] != side[u])
+                    return true;
+            return false;
+        }
+
+        // Weight above the allowed maximum on both sides
+        static long long get_excess(const long long weight[2], const long long max_weight[2])
+        {
+            return std::max(0LL, weight[0] - max_weight[0]) + std::max(0LL, weight[1] - max_weight[1]);
+        }
+    };
+}
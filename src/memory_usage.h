@@ -0,0 +1,44 @@
+/*****************************************************************************
+* name: memory_usage.h
+*
+* author: Biryukov V. biryukov.vova@gmail.com
+*
+* desc: Resident memory of the process for stage logging
+*
+* license: GPLv3
+*
+*****************************************************************************/
+
+#pragma once
+#include <string>
+#include <fstream>
+#include <sstream>
+namespace swift
+{
+    // Current and peak resident set size in kilobytes, read from
+    // /proc/self/status. Both stay 0 where it is not available.
+    struct memory_usage
+    {
+        unsigned long long rss, peak;
+
+        memory_usage()
+        {
+            rss = 0;
+            peak = 0;
+            std::ifstream status("/proc/self/status");
+            std::string line;
+            while (std::getline(status, line))
+            {
+                if (line.compare(0, 6, "VmRSS:") == 0)
+                    std::istringstream(line.substr(6)) >> rss;
+                else if (line.compare(0, 6, "VmHWM:") == 0)
+                    std::istringstream(line.substr(6)) >> peak;
+            }
+        }
+    };
+
+    inline std::ostream & operator<<( std::ostream & os, const memory_usage & m )
+    {
+        return os << "rss = " << m.rss / 1024 << " MB, peak = " << m.peak / 1024 << " MB";
+    }
+}
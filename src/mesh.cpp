@@ -14,6 +14,7 @@
 #include <string.h>
 #include <set>
 #include <iterator>
+#include <chrono>
 #include "mesh.h"
 #include "meshsplitter.h"
 
@@ -34,22 +35,132 @@ namespace swift
     /*****************************************************************************
     *  Constructor
     *****************************************************************************/
+    mesh::mesh()
+    {
+        set_defaults();
+    }
+
     mesh::mesh(char* path)
     {
-        use_volume_constraints = false;
+        set_defaults();
         read_from_file(path);
-        init();
-        set_points();
-        create_facets();
-        set_holes();
+        set_stage_keys(path);
+    }
+
+    mesh::mesh(mesh && m)
+    {
+        set_defaults();
+        take(m);
+    }
+
+    mesh & mesh::operator=(mesh && m)
+    {
+        if (this != &m)
+        {
+            release();
+            take(m);
+        }
+        return *this;
     }
 
     mesh::~mesh()
     {
+        release();
+    }
+
+    /*****************************************************************************
+    *  Ownership
+    *****************************************************************************/
+
+    // Hands the arrays of from over to to, from is left empty
+    void move_tetgenio(tetgenio & to, tetgenio & from)
+    {
+        to.deinitialize();
+        to = from;
+        from.initialize();
+    }
+
+    // Scalars and owning pointers of an empty mesh, the containers are
+    // left as they are
+    void mesh::set_defaults()
+    {
+        segments.x = segments.y = segments.z = 1;
+        cells_partitioner = NULL;
+        parts_count = 1;
+        submesh_node_order = node_order_none;
+        submesh_cell_blocks = false;
+        quality = -1;
+        average_step = -1;
+        threads_count = 0;
+        merge_coplanar_facets = false;
+        release_memory_early = false;
+        use_volume_constraints = false;
+        polygons_slab = NULL;
+        vertices_slab = NULL;
+        for (int i = 0; i < stages_count; i++)
+        {
+            stage_keys[i] = 0;
+            is_loaded[i] = false;
+        }
+    }
+
+    void mesh::release()
+    {
+        release_facets();
         for (int i = 0; i < figures.size(); i++)
         {
             delete figures[i];
         }
+        figures.clear();
+        delete cells_partitioner;
+        cells_partitioner = NULL;
+        vector<boundary_face>().swap(boundaries);
+        vector<contact_face>().swap(contacts);
+        vector<int_t>().swap(boundary_faces_count);
+        vector<int_t>().swap(contact_faces_count);
+        vector<int_t>().swap(cell_mesh_ids);
+        vector<int>().swap(point_offsets);
+        vector<int>().swap(boundary_offsets);
+        vector<int>().swap(contact_offsets);
+        partition_method.clear();
+        checkpoint_directory.clear();
+    }
+
+    // Takes over everything m owns, m is left as a default constructed mesh
+    void mesh::take(mesh & m)
+    {
+        figures.swap(m.figures);
+        move_tetgenio(in, m.in);
+        move_tetgenio(out, m.out);
+        polygons_slab = m.polygons_slab;
+        vertices_slab = m.vertices_slab;
+        segments = m.segments;
+        cells_partitioner = m.cells_partitioner;
+        partition_method.swap(m.partition_method);
+        parts_count = m.parts_count;
+        submesh_node_order = m.submesh_node_order;
+        submesh_cell_blocks = m.submesh_cell_blocks;
+        quality = m.quality;
+        average_step = m.average_step;
+        threads_count = m.threads_count;
+        merge_coplanar_facets = m.merge_coplanar_facets;
+        release_memory_early = m.release_memory_early;
+        use_volume_constraints = m.use_volume_constraints;
+        boundaries.swap(m.boundaries);
+        contacts.swap(m.contacts);
+        boundary_faces_count.swap(m.boundary_faces_count);
+        contact_faces_count.swap(m.contact_faces_count);
+        cell_mesh_ids.swap(m.cell_mesh_ids);
+        point_offsets.swap(m.point_offsets);
+        boundary_offsets.swap(m.boundary_offsets);
+        contact_offsets.swap(m.contact_offsets);
+        checkpoint_directory.swap(m.checkpoint_directory);
+        for (int i = 0; i < stages_count; i++)
+        {
+            stage_keys[i] = m.stage_keys[i];
+            is_loaded[i] = m.is_loaded[i];
+        }
+        m.set_defaults();
     }
 
     /*****************************************************************************
@@ -63,20 +174,25 @@ namespace swift
         return 1;
     }
 
-    int mesh::calculate_number_of_points()
+    void mesh::calculate_offsets()
     {
-        int n = 0;
+        point_offsets.assign(figures.size() + 1, 0);
+        boundary_offsets.assign(figures.size() + 1, 0);
+        contact_offsets.assign(figures.size() + 1, 0);
         for (vector<figure*>::size_type i = 0; i < figures.size(); i++)
-            n += figures.at(i)->points.size();
-        return n;
-    }
-
-    int mesh::calculate_number_of_trifacets()
-    {
-        int n = 0;
-        for (vector<figure*>::size_type i = 0; i < figures.size(); i++)
-            n += figures.at(i)->trifacets.size();
-        return n;
+        {
+            const figure * f = figures.at(i);
+            vector<int> facet_nums = figures.at(i)->get_non_contact_facets();
+            int n = 0;
+            for ( unsigned int j = 0; j < facet_nums.size(); j++ )
+                n += f->facets.at(facet_nums[j]).trifacets.size();
+            int m = 0;
+            for ( unsigned int j = 0; j < f->contacts.size(); j++ )
+                m += f->facets.at(f->contacts[j].at(0)).trifacets.size();
+            point_offsets[i + 1] = point_offsets[i] + f->points.size();
+            boundary_offsets[i + 1] = boundary_offsets[i] + n;
+            contact_offsets[i + 1] = contact_offsets[i] + m;
+        }
     }
 
     int mesh::calculate_number_of_holes()
@@ -105,9 +221,51 @@ namespace swift
         quality   = ini.request<REAL>("Mesh", "quality", -1);
 
         average_step   = ini.request<REAL>("Mesh", "average_step", -1);
+        threads_count  = ini.request<int>("Mesh", "number_of_threads", 0);
+        checkpoint_directory = ini.request<string>("Checkpoints", "directory", "");
+        string merge_s = ini.request<string>("Mesh", "merge_coplanar_facets", "False");
+        merge_coplanar_facets = (merge_s == "true" || merge_s == "True" || merge_s == "TRUE");
+        string release_s = ini.request<string>("Mesh", "release_memory_early", "False");
+        release_memory_early = (release_s == "true" || release_s == "True" || release_s == "TRUE");
         segments.x = ini.request<int>("Segments", "number_of_segments_x", -1);
         segments.y = ini.request<int>("Segments", "number_of_segments_y", -1);
         segments.z = ini.request<int>("Segments", "number_of_segments_z", -1);
+        partition_method = ini.request<string>("Segments", "partition_method", "Slabs");
+        const string & method = partition_method;
+        int parts = ini.request<int>("Segments", "number_of_parts", segments.x * segments.y * segments.z);
+        if (method == "Slabs" && (segments.x < 1 || segments.y < 1 || segments.z < 1))
+        {
+            cout << "Error: Slabs partitioning needs number_of_segments_x, _y and _z of at least 1, got "
+                 << segments.x << " " << segments.y << " " << segments.z << ".";
+            std::exit(1);
+        }
+        if (method != "Slabs" && parts < 1)
+        {
+            cout << "Error: number_of_parts should be at least 1, got " << parts << ".";
+            std::exit(1);
+        }
+        parts_count = parts;
+        if (method == "Slabs")
+            cells_partitioner = new slab_partitioner(segments.x, segments.y, segments.z);
+        else if (method == "Hilbert")
+            cells_partitioner = new hilbert_partitioner();
+        else if (method == "RCB")
+            cells_partitioner = new rcb_partitioner();
+        else if (method == "Graph")
+            cells_partitioner = new graph_partitioner();
+        else
+        {
+            cout << "Error: there is no such partition method: " << method << ".";
+            std::exit(1);
+        }
+        string order = ini.request<string>("Export", "node_order", "None");
+        if (!get_node_order_by_name(order, submesh_node_order))
+        {
+            cout << "Error: there is no such node order: " << order << ".";
+            std::exit(1);
+        }
+        string blocks_s = ini.request<string>("Export", "cell_blocks", "False");
+        submesh_cell_blocks = (blocks_s == "true" || blocks_s == "True" || blocks_s == "TRUE");
         int nof_figures = ini.request<int>("Figures", "number_of_figures", -1);
         for ( int i = 1; i <= nof_figures; i++ )
         {
@@ -162,50 +320,98 @@ namespace swift
             string s = ini.request<string>("Figures", "figure" + i_str + "_is_empty", "none");
             //std::cout << "em: " << s << std::endl;
             figures.back()->is_empty = (s == "true" || s == "True" || s == "TRUE");
+            s = ini.request<string>("Figures", "figure" + i_str + "_is_final_surface", "none");
+            figures.back()->is_final_surface = (s == "true" || s == "True" || s == "TRUE");
 
             stringstream ss1(ini.request<string>("Figures", "figure" + i_str + "_position", "none"));
             ss1 >> figures.back()->pos.x >> figures.back()->pos.y >> figures.back()->pos.z;
 
             stringstream ss2(ini.request<string>("Figures", "figure" + i_str + "_angles", "none"));
             ss2 >> figures.back()->ang.alpha >> figures.back()->ang.beta >> figures.back()->ang.gamma;
-            figures.back()->make_triangulation();
+            figures.back()->set_transform();
+            figures.back()->merge_coplanar_facets = merge_coplanar_facets;
+        }
+    }
 
+    // A stage's key covers the config entries and input files it depends
+    // on, chained with the key of the stage before it
+    void mesh::set_stage_keys(string path)
+    {
+        vector<config_entry> entries = read_config_entries(path);
+        hasher surface, volume, split;
+        for (unsigned int i = 0; i < entries.size(); i++)
+        {
+            const config_entry & e = entries[i];
+            hasher * h = &surface;
+            if (e.section == "Checkpoints" || e.section == "Export" || (e.section == "Mesh" && (e.name == "number_of_threads" || e.name == "release_memory_early")))
+                continue;
+            if (e.section == "Segments")
+                h = &split;
+            else if (e.section == "Mesh" && e.name == "quality")
+                h = &volume;
+            h->add(e.section);
+            h->add(e.name);
+            h->add(e.value);
         }
+        vector<string> files;
+        for (unsigned int i = 0; i < figures.size(); i++)
+            figures[i]->get_input_files(files);
+        for (unsigned int i = 0; i < files.size(); i++)
+            surface.add_file(files[i]);
+
+        stage_keys[stage_surface] = surface.value;
+        stage_keys[stage_plc] = surface.value;
+        hasher v(stage_keys[stage_plc]);
+        v.add(&volume.value, sizeof(volume.value));
+        stage_keys[stage_volume] = v.value;
+        hasher s(stage_keys[stage_volume]);
+        s.add(&split.value, sizeof(split.value));
+        stage_keys[stage_split] = s.value;
+        stage_keys[stage_export] = s.value;
     }
 
+    // Sizes everything from the figure offsets. The facets take their
+    // polygons and vertex lists from two slabs instead of a pair of
+    // allocations each, see release_facets.
     void mesh::init()
     {
-        in.numberofpoints = calculate_number_of_points();
-        in.numberoffacets = calculate_number_of_trifacets();
-        in.numberofholes = calculate_number_of_holes();
+        calculate_offsets();
+        allocate_plc(point_offsets.back(), boundary_offsets.back() + 2*contact_offsets.back(), calculate_number_of_holes());
+        boundaries.resize(boundary_offsets.back());
+        contacts.resize(contact_offsets.back());
+    }
+
+    void mesh::allocate_plc(int points_count, int facets_count, int holes_count)
+    {
+        in.numberofpoints = points_count;
+        in.numberoffacets = facets_count;
+        in.numberofholes = holes_count;
         // Creating arrays
         in.pointlist = new REAL[3*in.numberofpoints];
         in.facetlist = new tetgenio::facet[in.numberoffacets];
         in.facetmarkerlist = new int[in.numberoffacets];
         in.holelist = new REAL[3*in.numberofholes];
-        //boundaries.resize(in.numberoffacets); ????????
+        polygons_slab = new tetgenio::polygon[in.numberoffacets];
+        vertices_slab = new int[3*in.numberoffacets];
     }
 
     void mesh::set_points()
     {
-        int offset = 0;
-        for (vector<figure*>::iterator it = figures.begin(); it != figures.end(); it++)
+        parallel_for(figures.size(), threads_count, [this](int i)
         {
-            for (vector<point>::size_type i = 0; i < (*it)->points.size(); i++)
-            {
-                point t = (*it)->get_transformed_point(i);
-                in.pointlist[3*(i + offset) + 0] = t.x;
-                in.pointlist[3*(i + offset) + 1] = t.y;
-                in.pointlist[3*(i + offset) + 2] = t.z;
-            }
-            offset += (*it)->points.size();
-        }
+            figures[i]->transform_points(in.pointlist + 3*point_offsets[i]);
+        });
     }
 
-    void mesh::set_figure_boundaries(figure * f, int point_offset)
+    // Fills the figure's ranges of boundaries and contacts
+    void mesh::set_figure_boundaries(int n_of_figure)
     {
+        const figure * f = figures.at(n_of_figure);
+        int point_offset = point_offsets.at(n_of_figure);
+        int b = boundary_offsets.at(n_of_figure);
+        int c = contact_offsets.at(n_of_figure);
         // Creating set of numbers of the non-contact facets
-        vector<int> facet_nums = f->get_non_contact_facets();
+        vector<int> facet_nums = figures.at(n_of_figure)->get_non_contact_facets();
         // Setting boundaries
         for ( unsigned int i = 0; i < facet_nums.size(); i++ )
         {
@@ -216,17 +422,17 @@ namespace swift
                 boundary_face tb = {int_t(f->trifacets.at(tfacn).points[0] + point_offset),
                                     int_t(f->trifacets.at(tfacn).points[1] + point_offset),
                                     int_t(f->trifacets.at(tfacn).points[2] + point_offset)};
-                boundaries.push_back(tb);
+                boundaries[b++] = tb;
             }
         }
         // Setting contacts
         for ( unsigned int i = 0; i < f->contacts.size(); i++ )
         {
-            vector<int> c = f->contacts.at(i);
-            for ( unsigned int j = 0; j < f->facets.at(c.at(0)).trifacets.size(); j++ )
+            const vector<int> & cn = f->contacts.at(i);
+            for ( unsigned int j = 0; j < f->facets.at(cn.at(0)).trifacets.size(); j++ )
             {
-                int tfacn = f->facets.at(c.at(0)).trifacets.at(j);
-                int dif = *(f->facets.at(c.at(1)).trifacets.begin()) - *(f->facets.at(c.at(0)).trifacets.begin());
+                int tfacn = f->facets.at(cn.at(0)).trifacets.at(j);
+                int dif = *(f->facets.at(cn.at(1)).trifacets.begin()) - *(f->facets.at(cn.at(0)).trifacets.begin());
                 boundary_face c1 = {int_t(f->trifacets.at(tfacn).points[0] + point_offset),
                                     int_t(f->trifacets.at(tfacn).points[1] + point_offset),
                                     int_t(f->trifacets.at(tfacn).points[2] + point_offset)};
@@ -236,47 +442,86 @@ namespace swift
                 contact_face temp;
                 temp.faces[0] = c1;
                 temp.faces[1] = c2;
-                contacts.push_back(temp);
+                contacts[c++] = temp;
             }
         }
     }
 
-    void mesh::set_boundaries()
+    void mesh::set_facet(int n_of_facet, const boundary_face & b, int marker)
     {
-        int offset = 0;
-        for ( unsigned int i = 0; i < figures.size(); i++ )
-        {
-            set_figure_boundaries(figures.at(i), offset);
-            offset += figures.at(i)->points.size();
-        }
+        in.facetmarkerlist[n_of_facet] = marker;
+        link_facet(n_of_facet);
+        tetgenio::polygon * p = &in.facetlist[n_of_facet].polygonlist[0];
+        p->vertexlist[0] = b.nodes[0];
+        p->vertexlist[1] = b.nodes[1];
+        p->vertexlist[2] = b.nodes[2];
     }
 
-    void mesh::set_facet(int n_of_facet, boundary_face & b, int marker)
+    // Points the facet at its polygon and vertex list in the slabs
+    void mesh::link_facet(int n_of_facet)
     {
-        in.facetmarkerlist[n_of_facet] = marker;
         tetgenio::facet * f = &(in.facetlist[n_of_facet]);
         f->numberofpolygons = 1;
-        f->polygonlist = new tetgenio::polygon[f->numberofpolygons];
+        f->polygonlist = &polygons_slab[n_of_facet];
         f->numberofholes = 0;
         f->holelist = NULL;
         tetgenio::polygon * p = &f->polygonlist[0];
         p->numberofvertices = 3;
-        p->vertexlist = new int[p->numberofvertices];
-        p->vertexlist[0] = b.nodes[0];
-        p->vertexlist[1] = b.nodes[1];
-        p->vertexlist[2] = b.nodes[2];
+        p->vertexlist = &vertices_slab[3*n_of_facet];
     }
 
+    // Boundary facets of all figures go first, then the contact pairs.
+    // Every figure writes only its own ranges, so figures run in parallel.
     void mesh::create_facets()
     {
-        set_boundaries();
-        for (unsigned int i = 0; i<boundaries.size(); i++)
-            set_facet(i, boundaries.at(i));
-        for (unsigned int i = 0; i<contacts.size(); i++)
+        int n_of_boundaries = boundary_offsets.back();
+        parallel_for(figures.size(), threads_count, [this, n_of_boundaries](int k)
+        {
+            set_figure_boundaries(k);
+            for (int i = boundary_offsets[k]; i < boundary_offsets[k + 1]; i++)
+                set_facet(i, boundaries[i]);
+            for (int i = contact_offsets[k]; i < contact_offsets[k + 1]; i++)
+            {
+                set_facet(n_of_boundaries + 2*i, contacts[i].faces[0], 2/*i + 1, 2*/);
+                set_facet(n_of_boundaries + 2*i + 1, contacts[i].faces[1], 2/*i + 1, 2*/);
+            }
+        });
+    }
+
+    // Frees the facets of in before tetgenio::deinitialize, which would
+    // delete every polygon and vertex list separately
+    void mesh::release_facets()
+    {
+        delete [] in.facetlist;
+        in.facetlist = NULL;
+        in.numberoffacets = 0;
+        delete [] polygons_slab;
+        polygons_slab = NULL;
+        delete [] vertices_slab;
+        vertices_slab = NULL;
+    }
+
+    // Frees what tetgen put into out besides the points and tetrahedra,
+    // which are all the submeshes are made of
+    void mesh::release_volume_extras()
+    {
+        REAL ** reals[] = {&out.pointattributelist, &out.pointmtrlist, &out.tetrahedronattributelist,
+                           &out.tetrahedronvolumelist};
+        int ** ints[] = {&out.pointmarkerlist, &out.neighborlist, &out.trifacelist,
+                         &out.trifacemarkerlist, &out.o2facelist, &out.adjtetlist, &out.edgelist,
+                         &out.edgemarkerlist, &out.o2edgelist, &out.edgeadjtetlist};
+        for (unsigned int i = 0; i < sizeof(reals) / sizeof(reals[0]); i++)
+        {
+            delete [] *reals[i];
+            *reals[i] = NULL;
+        }
+        for (unsigned int i = 0; i < sizeof(ints) / sizeof(ints[0]); i++)
         {
-            set_facet(boundaries.size() + 2*i, contacts.at(i).faces[0], 2/*i + 1, 2*/);
-            set_facet(boundaries.size() + 2*i + 1, contacts.at(i).faces[1], 2/*i + 1, 2*/);
+            delete [] *ints[i];
+            *ints[i] = NULL;
         }
+        out.numberoftrifaces = 0;
+        out.numberofedges = 0;
     }
 
     void mesh::set_holes()
@@ -383,7 +628,240 @@ namespace swift
         out.save_faces(filename);
     }
 
-    // It is needed only in split and save function
+    // Runs the stages from the given one on. The state the earlier stages
+    // left is loaded from their checkpoints; where one is missing or out
+    // of date, the run starts at that stage instead.
+    void mesh::run(pipeline_stage from)
+    {
+        int first = from;
+        if (first > stage_surface && checkpoint_directory.empty())
+        {
+            cout << "No checkpoint directory is set, starting from the first stage" << endl;
+            first = stage_surface;
+        }
+        while (first > stage_surface && !load_state(first - 1))
+            first--;
+        for (int stage = first; stage < stages_count; stage++)
+        {
+            cout << "Stage " << get_stage_name(stage) << endl;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            switch (stage)
+            {
+            case stage_surface:
+                make_surface();
+                break;
+            case stage_plc:
+                make_plc();
+                break;
+            case stage_volume:
+                build();
+                save((char*)"out");
+                break;
+            case stage_split:
+                split();
+                break;
+            case stage_export:
+                save_submeshes();
+                break;
+            }
+            if (stage != stage_export)
+                save_checkpoint(stage);
+            if (release_memory_early)
+                release_stage_inputs(stage);
+            std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+            cout << "Stage " << get_stage_name(stage) << " is done in " << seconds.count() << " s: " << memory_usage() << endl;
+        }
+    }
+
+    // Frees what no stage after the given one reads. The figure surfaces
+    // end up in the tetgen input, which is last read by the volume stage;
+    // out is released by the export as it goes.
+    void mesh::release_stage_inputs(int stage)
+    {
+        if (stage == stage_plc)
+        {
+            for (unsigned int i = 0; i < figures.size(); i++)
+                figures[i]->release_surface();
+        }
+        else if (stage == stage_volume)
+        {
+            release_facets();
+            in.deinitialize();
+            in.initialize();
+            vector<int>().swap(point_offsets);
+            vector<int>().swap(boundary_offsets);
+            vector<int>().swap(contact_offsets);
+        }
+    }
+
+    void mesh::make_surface()
+    {
+        for (unsigned int i = 0; i < figures.size(); i++)
+            figures[i]->make_triangulation(threads_count);
+    }
+
+    void mesh::make_plc()
+    {
+        init();
+        set_points();
+        create_facets();
+        set_holes();
+        boundary_faces_count.clear();
+        contact_faces_count.clear();
+        figures[0]->set_boundaries_and_contacts(boundaries, contacts, boundary_faces_count, contact_faces_count);
+    }
+
+    // Loads what the stages up to the given one leave for the next ones:
+    // the figure surfaces after surface, the PLC with its boundary and
+    // contact faces after plc, plus the volume mesh and its partition.
+    bool mesh::load_state(int stage)
+    {
+        if (stage == stage_surface)
+            return load_checkpoint(stage_surface);
+        return load_checkpoint(stage_plc) &&
+               (stage < stage_volume || load_checkpoint(stage_volume)) &&
+               (stage < stage_split || load_checkpoint(stage_split));
+    }
+
+    bool mesh::load_checkpoint(int stage)
+    {
+        if (is_loaded[stage])
+            return true;
+        checkpoint_reader r(checkpoint_directory, stage, stage_keys[stage]);
+        unsigned long long n = 0;
+        if (r.valid && stage == stage_surface)
+        {
+            r.read_value(n);
+            r.valid = r.valid && n == figures.size();
+            vector< vector<point> > points(figures.size());
+            vector< vector<trifacet> > trifacets(figures.size());
+            vector< vector< vector<int> > > facet_trifacets(figures.size());
+            for (unsigned int i = 0; r.valid && i < figures.size(); i++)
+            {
+                r.read_vector(points[i]);
+                r.read_vector(trifacets[i]);
+                r.read_value(n);
+                r.valid = r.valid && n == figures[i]->facets.size();
+                facet_trifacets[i].resize(figures[i]->facets.size());
+                for (unsigned int j = 0; r.valid && j < facet_trifacets[i].size(); j++)
+                    r.read_vector(facet_trifacets[i][j]);
+            }
+            for (unsigned int i = 0; r.valid && i < figures.size(); i++)
+            {
+                figures[i]->points.swap(points[i]);
+                figures[i]->trifacets.swap(trifacets[i]);
+                for (unsigned int j = 0; j < facet_trifacets[i].size(); j++)
+                    figures[i]->facets[j].trifacets.swap(facet_trifacets[i][j]);
+            }
+        }
+        else if (r.valid && stage == stage_plc)
+        {
+            vector<REAL> points, holes;
+            vector<int> vertices, markers;
+            vector<boundary_face> b;
+            vector<contact_face> c;
+            vector<int_t> bc, cc;
+            r.read_vector(points) && r.read_vector(vertices) && r.read_vector(markers) && r.read_vector(holes) &&
+            r.read_vector(b) && r.read_vector(c) && r.read_vector(bc) && r.read_vector(cc);
+            r.valid = r.valid && points.size() % 3 == 0 && vertices.size() == 3 * markers.size() && holes.size() % 3 == 0;
+            if (r.valid)
+            {
+                allocate_plc(points.size() / 3, markers.size(), holes.size() / 3);
+                copy(points.begin(), points.end(), in.pointlist);
+                copy(vertices.begin(), vertices.end(), vertices_slab);
+                copy(markers.begin(), markers.end(), in.facetmarkerlist);
+                copy(holes.begin(), holes.end(), in.holelist);
+                for (int i = 0; i < in.numberoffacets; i++)
+                    link_facet(i);
+                boundaries.swap(b);
+                contacts.swap(c);
+                boundary_faces_count.swap(bc);
+                contact_faces_count.swap(cc);
+            }
+        }
+        else if (r.valid && stage == stage_volume)
+        {
+            // Read straight into the arrays tetgenio owns, the volume mesh is the largest
+            unsigned long long m = 0;
+            REAL * points = r.read_length<REAL>(n) && n % 3 == 0 ? new REAL[n] : NULL;
+            r.valid = r.valid && points != NULL && r.read_data(points, n);
+            int * tetrahedra = r.valid && r.read_length<int>(m) && m % 4 == 0 ? new int[m] : NULL;
+            r.valid = r.valid && tetrahedra != NULL && r.read_data(tetrahedra, m);
+            if (r.valid)
+            {
+                out.pointlist = points;
+                out.numberofpoints = n / 3;
+                out.tetrahedronlist = tetrahedra;
+                out.numberoftetrahedra = m / 4;
+                out.numberofcorners = 4;
+            }
+            else
+            {
+                delete [] points;
+                delete [] tetrahedra;
+            }
+        }
+        else if (r.valid && stage == stage_split)
+        {
+            vector<int_t> ids;
+            r.read_vector(ids);
+            r.valid = r.valid && int(ids.size()) == out.numberoftetrahedra;
+            if (r.valid)
+                cell_mesh_ids.swap(ids);
+        }
+        if (!r.valid)
+        {
+            cout << "Checkpoint " << get_checkpoint_path(checkpoint_directory, stage) << " is missing or out of date" << endl;
+            return false;
+        }
+        cout << "Checkpoint " << get_checkpoint_path(checkpoint_directory, stage) << " is loaded" << endl;
+        is_loaded[stage] = true;
+        return true;
+    }
+
+    void mesh::save_checkpoint(int stage)
+    {
+        if (checkpoint_directory.empty())
+            return;
+        checkpoint_writer w(checkpoint_directory, stage, stage_keys[stage]);
+        switch (stage)
+        {
+        case stage_surface:
+            w.write_value<unsigned long long>(figures.size());
+            for (unsigned int i = 0; i < figures.size(); i++)
+            {
+                w.write_vector(figures[i]->points);
+                w.write_vector(figures[i]->trifacets);
+                w.write_value<unsigned long long>(figures[i]->facets.size());
+                for (unsigned int j = 0; j < figures[i]->facets.size(); j++)
+                    w.write_vector(figures[i]->facets[j].trifacets);
+            }
+            break;
+        case stage_plc:
+            w.write_array(in.pointlist, 3ULL * in.numberofpoints);
+            w.write_array(vertices_slab, 3ULL * in.numberoffacets);
+            w.write_array(in.facetmarkerlist, in.numberoffacets);
+            w.write_array(in.holelist, 3ULL * in.numberofholes);
+            w.write_vector(boundaries);
+            w.write_vector(contacts);
+            w.write_vector(boundary_faces_count);
+            w.write_vector(contact_faces_count);
+            break;
+        case stage_volume:
+            w.write_array(out.pointlist, 3ULL * out.numberofpoints);
+            w.write_array(out.tetrahedronlist, 4ULL * out.numberoftetrahedra);
+            break;
+        case stage_split:
+            w.write_vector(cell_mesh_ids);
+            break;
+        }
+        if (w.close())
+            cout << "Checkpoint " << w.path << " is saved" << endl;
+        else
+            cout << "Warning: cannot write checkpoint " << w.path << endl;
+    }
+
+    // It is needed only in save_submeshes
     // Isn't my code
     struct Vector3
         {
@@ -404,25 +882,30 @@ namespace swift
                 return Vector3(a * x, a * y, a * z);
             };
         };
-    struct CellAvgPoint
+    // tetgen's point list is read as an array of Vector3
+    static_assert(sizeof(Vector3) == 3 * sizeof(REAL), "Vector3 must be three packed REALs");
+    // Assigns every cell to a submesh by its centre with the partitioner
+    // chosen in [Segments]
+    void mesh::split()
     {
-        Vector3 point;
-        int cellIndex;
-        static bool CompareX(CellAvgPoint p1, CellAvgPoint p2)
-        {
-            return p1.point.x < p2.point.x;
-        }
-        static bool CompareY(CellAvgPoint p1, CellAvgPoint p2)
-        {
-            return p1.point.y < p2.point.y;
-        }
-        static bool CompareZ(CellAvgPoint p1, CellAvgPoint p2)
+        int_t cellsCount = out.numberoftetrahedra;
+        vector<REAL> centres(3 * cellsCount);
+        parallel_for(cellsCount, threads_count, [&](int i)
         {
-            return p1.point.z < p2.point.z;
-        }
-    };
+            const int * cell = &out.tetrahedronlist[4*i];
+            for (int d = 0; d < 3; d++)
+            {
+                REAL sum = out.pointlist[3*cell[0] + d] + out.pointlist[3*cell[1] + d];
+                sum = sum + out.pointlist[3*cell[2] + d];
+                sum = sum + out.pointlist[3*cell[3] + d];
+                centres[3*i + d] = sum * 0.25;
+            }
+        }, 4096);
+        cells_partitioner->partition(centres, out.tetrahedronlist, parts_count, threads_count, cell_mesh_ids);
+    }
 
-    void mesh::split_and_save()
+    // Builds the submeshes with MeshSplitter and writes them to Data/
+    void mesh::save_submeshes()
     {
         // Split mesh on segments.x * segments.y * segments.z pieces and save
         // Isn't my code
@@ -430,64 +913,12 @@ namespace swift
         int_t nodesCount = out.numberofpoints;
         cout << "cellsCount = " << cellsCount << "\n";
         typedef MeshSplitter::TransitionNode TransitionNode;
-        Vector3 * vertices = new Vector3[nodesCount];
-        for (int_t i = 0; i < nodesCount; i++)
-        {
-            vertices[i].x = out.pointlist[3*i + 0];
-            vertices[i].y = out.pointlist[3*i + 1];
-            vertices[i].z = out.pointlist[3*i + 2];
-        }
-        //int * cellIndices  = out.tetrahedronlist;
-	    int_t * cellIndices  = new int_t [4 * cellsCount];
-        int_t * meshIds      = new int_t [cellsCount];
-        CellAvgPoint *cellPoints = new CellAvgPoint[cellsCount];
-        for( int_t i = 0; i < cellsCount; i++)
-        {
-            meshIds[i] = 0;
-            cellIndices[4*i+0] = int_t(out.tetrahedronlist[4*i+0]);
-            cellIndices[4*i+1] = int_t(out.tetrahedronlist[4*i+1]);
-            cellIndices[4*i+2] = int_t(out.tetrahedronlist[4*i+2]);
-            cellIndices[4*i+3] = int_t(out.tetrahedronlist[4*i+3]);
-            Vector3 avg = Vector3(0, 0, 0);
-            avg = avg +  vertices[cellIndices[i * 4 + 0]];
-            avg = avg +  vertices[cellIndices[i * 4 + 1]];
-            avg = avg +  vertices[cellIndices[i * 4 + 2]];
-            avg = avg +  vertices[cellIndices[i * 4 + 3]];
-            avg = avg*0.25;
-            cellPoints[i].point = avg;
-            cellPoints[i].cellIndex = i;
-        }
-        int xSegmentsCount = segments.x;
-        int ySegmentsCount = segments.y;
-        int zSegmentsCount = segments.z;
-
-        int currSegment;
-        //typedef bool (*ftype)(CellAvgPoint,CellAvgPoint);
-        sort(cellPoints, cellPoints + cellsCount, CellAvgPoint::CompareX);
-        currSegment = 0;
-        for(int_t i = 0; i < cellsCount; i++)
-        {
-            while((currSegment + 1 < xSegmentsCount) && (CellAvgPoint::CompareX(cellPoints[(currSegment + 1) * cellsCount / xSegmentsCount], cellPoints[i])))
-                currSegment++;
-            meshIds[cellPoints[i].cellIndex] += currSegment;
-        }
-        sort(cellPoints, cellPoints + cellsCount, CellAvgPoint::CompareY);
-        currSegment = 0;
-        for(int_t i = 0; i < cellsCount; i++)
-        {
-            while((currSegment + 1 < ySegmentsCount) && (CellAvgPoint::CompareY(cellPoints[(currSegment + 1) * cellsCount / ySegmentsCount], cellPoints[i])))
-                currSegment++;
-            meshIds[cellPoints[i].cellIndex] += xSegmentsCount * currSegment;
-        }
-        sort(cellPoints, cellPoints + cellsCount, CellAvgPoint::CompareZ);
-        currSegment = 0;
-        for(int_t i = 0; i < cellsCount; i++)
-        {
-            while((currSegment + 1 < zSegmentsCount) && (CellAvgPoint::CompareZ(cellPoints[(currSegment + 1) * cellsCount / zSegmentsCount], cellPoints[i])))
-                currSegment++;
-            meshIds[cellPoints[i].cellIndex] += xSegmentsCount * ySegmentsCount * currSegment;
-        }
-        delete [] cellPoints;
+        // The splitter and the exporter read tetgen's arrays in place: the
+        // tetrahedra as unsigned indices, the points as Vector3 triples
+        release_volume_extras();
+        const int_t * cellIndices = reinterpret_cast<const int_t *>(out.tetrahedronlist);
+        const Vector3 * vertices = reinterpret_cast<const Vector3 *>(out.pointlist);
+        int_t * meshIds      = cell_mesh_ids.empty() ? NULL : &cell_mesh_ids[0];
 
         // Complications here ////////////////////////////////////////////
 
@@ -496,20 +927,27 @@ namespace swift
         int_t * subMeshNodesCount = new int_t[subMeshesCount];
         subMeshNodesCount[0] = out.numberofpoints;
 
-        vector<int_t> contactFacesCount;
-        vector<int_t> boundaryFacesCount;
-
-
-        figures[0]->set_boundaries_and_contacts(boundaries, contacts, boundaryFacesCount, contactFacesCount);
-
-
         // ///////////////////////////////////////////////////////////////
 
         MeshSplitter mesh_splitter;
+        mesh_splitter.SetNodeOrder(submesh_node_order, out.pointlist, threads_count);
+        mesh_splitter.SetCellBlocks(submesh_cell_blocks);
         mesh_splitter.LoadBaseMeshes(cellIndices, meshIds, cellsCount, subMeshNodesCount, subMeshesCount,
-                                        contacts.data(), contactFacesCount.data(), contactFacesCount.size(),
-                                        boundaries.data(), boundaryFacesCount.data(), boundaryFacesCount.size());
-        cout << "Mesh was split successfully" << endl << endl;
+                                        contacts.data(), contact_faces_count.data(), contact_faces_count.size(),
+                                        boundaries.data(), boundary_faces_count.data(), boundary_faces_count.size());
+        cout << "Mesh was split successfully, splitter peak = " << mesh_splitter.PeakBytes() / (1024 * 1024) << " MB" << endl << endl;
+        partition_report report;
+        report.method = partition_method;
+        report.cells_count = cellsCount;
+        report.nodes_count = nodesCount;
+        vector<int_t> ownCellsCount(mesh_splitter.GetMeshesCount(), 0);
+        for (int_t i = 0; i < cellsCount; i++)
+            ownCellsCount[meshIds[i]]++;
+        // The splitter keeps its own copies of the cells and their submeshes
+        delete [] out.tetrahedronlist;
+        out.tetrahedronlist = NULL;
+        out.numberoftetrahedra = 0;
+        vector<int_t>().swap(cell_mesh_ids);
 
         int_t meshesCount = mesh_splitter.GetMeshesCount();
         int_t maxNodesCount = 0;
@@ -541,6 +979,15 @@ namespace swift
             int_t localNodesCount = mesh_splitter.GetNodesCount(meshIndex);
             outFile.write((const char*)&localCellsCount, sizeof(int_t));
             outFile.write((const char*)&localNodesCount, sizeof(int_t));
+            if (submesh_cell_blocks)
+            {
+                // Interior cells are [0, interior end), shared own cells
+                // [interior end, own end), other regions' cells the rest
+                int_t interiorEnd = mesh_splitter.GetInteriorCellsCount(meshIndex);
+                int_t ownEnd = mesh_splitter.GetOwnCellsCount(meshIndex);
+                outFile.write((const char*)&interiorEnd, sizeof(int_t));
+                outFile.write((const char*)&ownEnd, sizeof(int_t));
+            }
             cout << fileName.str() << " info:" << endl << "  nodes: " << localNodesCount << endl << "  cells: " << localCellsCount << endl;
             mesh_splitter.GetCellLocalIndices(meshIndex, localCellIndicesBuf);
             outFile.write((const char*)localCellIndicesBuf, localCellsCount * 4 * sizeof(int_t));
@@ -605,10 +1052,12 @@ namespace swift
                 TransitionNode *transitionNodesBuf = new TransitionNode[transitionNodesCount];
                 mesh_splitter.GetTransitionNodes(meshIndex, regionIndex, transitionNodesBuf);
                 outFile.write((const char*)transitionNodesBuf, transitionNodesCount * sizeof(TransitionNode));
-                delete sharedIndicesBuf;
-                delete transitionNodesBuf;
+                report.add_pair(meshIndex, dstMeshIndex, sharedCellsCount, transitionNodesCount);
+                delete [] sharedIndicesBuf;
+                delete [] transitionNodesBuf;
             }
             outFile.close();
+            report.add_part(ownCellsCount[meshIndex], localCellsCount, localNodesCount, localContactFacesCount, localBoundaryFacesCount);
             cout << endl;
             //Debug
             cout << "Saving .node file" << endl;
@@ -645,7 +1094,18 @@ namespace swift
             }
             outFile.close();
         }
-        /**/
+        if (report.save("Data/partition_report.json"))
+            cout << "Partition report is saved to Data/partition_report.json" << endl;
+        else
+            cout << "Warning: cannot write Data/partition_report.json" << endl;
+        delete [] localCellIndicesBuf;
+        delete [] localNodeGlobalIndicesBuf;
+        delete [] localVerticesBuf;
+        delete [] localSubmeshNodesCount;
+        delete [] subMeshNodesCount;
+        delete [] out.pointlist;
+        out.pointlist = NULL;
+        out.numberofpoints = 0;
     }
 }
 /*****************************************************************************
@@ -656,21 +1116,31 @@ namespace swift
 
 //nullptr
 
-void process(swift::mesh m)
+void process(swift::mesh & m, swift::pipeline_stage from)
 {
-    m.build();
-    m.save((char*)"out");
-    m.split_and_save();
+    m.run(from);
 }
 
+// Usage: meshbuilder [config.ini] [--resume surface|plc|volume|split|export]
 int main(int argc, char ** argv)
 {
-    if (argc >= 2)
-    {
-        process(swift::mesh (argv[1]));
-    }
-    else
+    char * path = (char*)"meshbuilder.ini";
+    swift::pipeline_stage from = swift::stage_surface;
+    for (int i = 1; i < argc; i++)
     {
-        process(swift::mesh ((char*)"meshbuilder.ini"));
+        std::string arg = argv[i];
+        if (arg == "--resume" && i + 1 < argc)
+        {
+            from = swift::get_stage_by_name(argv[++i]);
+            if (from == swift::stages_count)
+            {
+                std::cout << "Error: there is no such stage: " << argv[i] << "." << std::endl;
+                return 1;
+            }
+        }
+        else
+            path = argv[i];
     }
+    swift::mesh m(path);
+    process(m, from);
 }
@@ -22,6 +22,12 @@
 #include "figures/rect_boundary.h"
 #include "figures/ply_model.h"
 #include "figures/layered_boundary.h"
+#include "checkpoint.h"
+#include "memory_usage.h"
+#include "partitioner.h"
+#include "graph_partitioner.h"
+#include "partition_report.h"
+#include "node_ordering.h"
 #include "settings.h"
 
 namespace swift
@@ -36,29 +42,73 @@ namespace swift
         std::vector<figure*> figures;
         tetgenio in, out;
         struct {int x, y, z;} segments;
+        // Partitioner of the cells into parts_count submeshes
+        partitioner * cells_partitioner;
+        std::string partition_method;
+        int_t parts_count;
+        // Numbering of the nodes inside every exported submesh
+        node_order submesh_node_order;
+        // Interior, partition boundary and shared cells in separate blocks
+        bool submesh_cell_blocks;
         REAL quality, average_step;
+        int threads_count;
+        bool merge_coplanar_facets;
+        // Free every structure once the last stage reading it is done
+        bool release_memory_early;
         std::vector<boundary_face> boundaries;
         std::vector<contact_face> contacts;
+        std::vector<int_t> boundary_faces_count, contact_faces_count;
+        // Submesh of every tetrahedron of out
+        std::vector<int_t> cell_mesh_ids;
+        // Prefix sums of the figures' points, boundary faces and contact faces
+        std::vector<int> point_offsets, boundary_offsets, contact_offsets;
+        // Polygons and vertex lists of all facets of in, one of each per facet
+        tetgenio::polygon * polygons_slab;
+        int * vertices_slab;
+        // Checkpoints are written only when a directory is set
+        std::string checkpoint_directory;
+        unsigned long long stage_keys[stages_count];
+        bool is_loaded[stages_count];
 
         void init();
         void read_from_file(std::string path);
         void set_points();
-        void set_figure_boundaries(figure * f, int point_offset);
-        void set_boundaries();
-        void set_facet(int n_of_facet, boundary_face & b, int marker = 0);
+        void set_figure_boundaries(int n_of_figure);
+        void set_facet(int n_of_facet, const boundary_face & b, int marker = 0);
+        void link_facet(int n_of_facet);
+        void allocate_plc(int points_count, int facets_count, int holes_count);
         void create_facets();
+        void release_facets();
+        void release_volume_extras();
+        void release_stage_inputs(int stage);
         void set_holes();
-        int calculate_number_of_points();
-        int calculate_number_of_trifacets();
+        void calculate_offsets();
         int calculate_number_of_holes();
         bool use_volume_constraints;
         void set_volume_constraints(tetgenio * mid);
+        void set_stage_keys(std::string path);
+        bool load_state(int stage);
+        bool load_checkpoint(int stage);
+        void save_checkpoint(int stage);
+        void set_defaults();
+        void release();
+        void take(mesh & m);
+
+        // The mesh owns its figures and tetgen arrays, it can be moved but not copied
+        mesh(const mesh &);
+        mesh & operator=(const mesh &);
     public:
-        mesh(){};
+        mesh();
         mesh(char* path);
+        mesh(mesh && m);
+        mesh & operator=(mesh && m);
         ~mesh();
+        void run(pipeline_stage from = stage_surface);
+        void make_surface();
+        void make_plc();
         void build();
         void save(char* filename);
-        void split_and_save();
+        void split();
+        void save_submeshes();
     };
 }
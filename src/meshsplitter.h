@@ -7,6 +7,11 @@
 
 #include <vector>
 #include <algorithm>
+#include <new>
+#include <atomic>
+#include <type_traits>
+#include "node_ordering.h"
+#include "parallel.h"
 namespace swift
 {
 typedef int_t IndexType;
@@ -60,127 +65,298 @@ private:
   std::vector<T> elements;
 };
 
-  class RegionBuilder
+// Sorts keys a byte at a time from the lowest one, up to the highest byte
+// any key uses. Short arrays go to std::sort.
+inline void RadixSort(IndexType *keys, IndexType count, std::vector<IndexType> &buffer)
+{
+  if(count < 64)
   {
-  public:
-    RegionBuilder(){}
-    ~RegionBuilder()
+    std::sort(keys, keys + count);
+    return;
+  }
+  IndexType maxKey = *std::max_element(keys, keys + count);
+  buffer.resize(count);
+  IndexType *src = keys;
+  IndexType *dst = &buffer[0];
+  for(int shift = 0; shift < 32 && (maxKey >> shift) > 0; shift += 8)
+  {
+    IndexType digitOffsets[257] = {0};
+    for(IndexType i = 0; i < count; i++)
     {
-      delete [] incidentRegionsPool;
-      delete [] nodeInfo;
+      digitOffsets[((src[i] >> shift) & 255) + 1]++;
     }
-    void LoadMesh(IndexType *cellIndices, IndexType *cellRegionId, IndexType cellsCount,
-                  ContactFace *contactFaces, IndexType contactFacesCount)
+    for(int digit = 0; digit < 256; digit++)
     {
-      nodesCount = 0;
-      for(IndexType cellIndex = 0; cellIndex < cellsCount; cellIndex++)
-      {
-        for(IndexType i = 0; i < 4; i++)
-        {
-          if(cellIndices[cellIndex * 4 + i] > nodesCount) nodesCount = cellIndices[cellIndex * 4 + i];
-        }
-      }
-      nodesCount++; //max index + 1
-
-      nodeInfo = new NodeInfo[nodesCount];
+      digitOffsets[digit + 1] += digitOffsets[digit];
+    }
+    for(IndexType i = 0; i < count; i++)
+    {
+      dst[digitOffsets[(src[i] >> shift) & 255]++] = src[i];
+    }
+    std::swap(src, dst);
+  }
+  if(src != keys) std::copy(src, src + count, keys);
+}
 
-      for(IndexType nodeIndex = 0; nodeIndex < nodesCount; nodeIndex++)
-      {
-        nodeInfo[nodeIndex].incidentRegionsCount = 0;
-      }
+// Bytes held by one or more arenas, and the most they ever held together.
+// Arenas of parallel steps may share one.
+struct ArenaUsage
+{
+  ArenaUsage()
+  {
+    bytes = 0;
+    peakBytes = 0;
+  }
+  void Add(size_t count)
+  {
+    size_t total = bytes += count;
+    size_t peak = peakBytes;
+    while(total > peak && !peakBytes.compare_exchange_weak(peak, total));
+  }
+  void Remove(size_t count)
+  {
+    bytes -= count;
+  }
+  std::atomic<size_t> bytes;
+  std::atomic<size_t> peakBytes;
+};
 
-      IndexType totalIncidentRegionsCount = 0;
+// Counts bytes held outside the arenas, in growable vectors or in library
+// calls, for as long as it lives
+class HeldBytes
+{
+public:
+  HeldBytes(ArenaUsage *usage, size_t bytes)
+  {
+    this->usage = usage;
+    this->bytes = bytes;
+    if(usage) usage->Add(bytes);
+  }
+  ~HeldBytes()
+  {
+    if(usage) usage->Remove(bytes);
+  }
+private:
+  HeldBytes(const HeldBytes &);
+  HeldBytes &operator=(const HeldBytes &);
 
-      for(IndexType cellIndex = 0; cellIndex < cellsCount; cellIndex++)
-      {
-        //IndexType regionId = cellRegionId[cellIndex];
-        for(IndexType i = 0; i < 4; i++)
-        {
-          IndexType nodeIndex = cellIndices[4 * cellIndex + i];
-          nodeInfo[nodeIndex].incidentRegionsCount++;
-          totalIncidentRegionsCount++;
-        }
-      }
-      for( int_t i = 0; i < contactFacesCount; i++)
-      {
-        for(int j = 0; j < 3; j++)
-        {
-          int nodeIndices[2];
-          nodeIndices[0] = contactFaces[i].faces[0].nodes[j];
-          nodeIndices[1] = contactFaces[i].faces[1].nodes[j];
+  ArenaUsage *usage;
+  size_t bytes;
+};
 
-          int count0 = nodeInfo[nodeIndices[0]].incidentRegionsCount;
-          int count1 = nodeInfo[nodeIndices[1]].incidentRegionsCount;
+// Bump allocator for arrays of plain data. Small arrays share blocks,
+// large ones get a block of their exact size. Everything is freed at once
+// by Release or the destructor.
+class MemoryArena
+{
+public:
+  MemoryArena(ArenaUsage *usage = 0, size_t blockBytes = size_t(1) << 20)
+  {
+    this->usage = usage;
+    this->blockBytes = blockBytes;
+    blockUsed = 0;
+    blockSize = 0;
+  }
+  ~MemoryArena()
+  {
+    Release();
+  }
 
-          nodeInfo[nodeIndices[0]].incidentRegionsCount += count1;
-          totalIncidentRegionsCount += count1;
+  // Uninitialized room for count objects
+  template<typename T>
+  T *Allocate(size_t count)
+  {
+    static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+    size_t bytes = count * sizeof(T);
+    if(bytes == 0) return 0;
+    if(bytes > blockBytes / 2)
+    {
+      // Kept behind the current block, which stays open for small arrays
+      char *block = AllocateBlock(bytes);
+      if(blocks.size() > 1) std::swap(blocks[blocks.size() - 1], blocks[blocks.size() - 2]);
+      return reinterpret_cast<T*>(block);
+    }
+    size_t start = (blockUsed + alignof(T) - 1) / alignof(T) * alignof(T);
+    if(blockSize == 0 || start + bytes > blockSize)
+    {
+      AllocateBlock(blockBytes);
+      blockSize = blockBytes;
+      start = 0;
+    }
+    blockUsed = start + bytes;
+    return reinterpret_cast<T*>(blocks.back().first + start);
+  }
 
-          nodeInfo[nodeIndices[1]].incidentRegionsCount += count0;
-          totalIncidentRegionsCount += count0;
-        }
-      }
-      incidentRegionsPool = new IndexType[totalIncidentRegionsCount];
-      IndexType poolOffset = 0;
-      for(IndexType nodeIndex = 0; nodeIndex < nodesCount; nodeIndex++)
-      {
-        nodeInfo[nodeIndex].incidentRegions = incidentRegionsPool + poolOffset;
-        poolOffset += nodeInfo[nodeIndex].incidentRegionsCount;
-        nodeInfo[nodeIndex].incidentRegionsCount = 0; //will be recomputed later
-      }
+  void Release()
+  {
+    for(size_t blockIndex = 0; blockIndex < blocks.size(); blockIndex++)
+    {
+      ::operator delete(blocks[blockIndex].first);
+      if(usage) usage->Remove(blocks[blockIndex].second);
+    }
+    blocks.clear();
+    blockUsed = 0;
+    blockSize = 0;
+  }
+  ArenaUsage *GetUsage()
+  {
+    return usage;
+  }
+private:
+  MemoryArena(const MemoryArena &);
+  MemoryArena &operator=(const MemoryArena &);
 
-      for(IndexType cellIndex = 0; cellIndex < cellsCount; cellIndex++)
-      {
-        IndexType regionId = cellRegionId[cellIndex];
-        for(IndexType i = 0; i < 4; i++)
-        {
-          IndexType nodeIndex = cellIndices[4 * cellIndex + i];
-          bool found = 0;
-          for(IndexType regions = 0; ((regions < nodeInfo[nodeIndex].incidentRegionsCount) && !found); regions++)
-          {
-            if(nodeInfo[nodeIndex].incidentRegions[regions] == regionId) found = 1;
-          }
-          if(!found) nodeInfo[nodeIndex].incidentRegions[nodeInfo[nodeIndex].incidentRegionsCount++] = regionId;
-        }
-      }
+  char *AllocateBlock(size_t bytes)
+  {
+    blocks.push_back(std::make_pair(static_cast<char*>(::operator new(bytes)), bytes));
+    if(usage) usage->Add(bytes);
+    return blocks.back().first;
+  }
 
+  std::vector< std::pair<char*, size_t> > blocks;
+  size_t blockBytes;
+  size_t blockUsed;
+  size_t blockSize;
+  ArenaUsage *usage;
+};
 
+// Local indices of the nodes of all regions in one open addressing table
+// keyed by the region and the global node index, so that a lookup costs the
+// same however many regions share the node
+class NodeLocalIndexMap
+{
+public:
+  void Reserve(IndexType entriesCount, MemoryArena &arena)
+  {
+    bits = 1;
+    while((size_t(1) << bits) < 2 * size_t(entriesCount)) bits++;
+    Entry empty = {emptyKey, 0};
+    entries = arena.Allocate<Entry>(size_t(1) << bits);
+    std::fill(entries, entries + (size_t(1) << bits), empty);
+  }
+  void Insert(IndexType regionId, IndexType nodeGlobalIndex, IndexType localIndex)
+  {
+    Entry &entry = entries[Find(GetKey(regionId, nodeGlobalIndex))];
+    entry.key = GetKey(regionId, nodeGlobalIndex);
+    entry.localIndex = localIndex;
+  }
+  // Changes an inserted entry only, so distinct keys may be updated concurrently
+  void Update(IndexType regionId, IndexType nodeGlobalIndex, IndexType localIndex)
+  {
+    Entry &entry = entries[Find(GetKey(regionId, nodeGlobalIndex))];
+    if(entry.key != emptyKey) entry.localIndex = localIndex;
+  }
+  IndexType Get(IndexType regionId, IndexType nodeGlobalIndex) const
+  {
+    const Entry &entry = entries[Find(GetKey(regionId, nodeGlobalIndex))];
+    return (entry.key != emptyKey) ? entry.localIndex : IndexType(-1);
+  }
+private:
+  struct Entry
+  {
+    unsigned long long key;
+    IndexType localIndex;
+  };
+  static const unsigned long long emptyKey = ~0ULL;
 
-      for(IndexType contactFaceIndex = 0; contactFaceIndex < contactFacesCount; contactFaceIndex++)
-      {
-        for(IndexType faceNode = 0; faceNode < 3; faceNode++)
-        {
-          IndexType nodeIndices[2];
-          nodeIndices[0] = contactFaces[contactFaceIndex].faces[0].nodes[faceNode];
-          nodeIndices[1] = contactFaces[contactFaceIndex].faces[1].nodes[faceNode];
+  static unsigned long long GetKey(IndexType regionId, IndexType nodeGlobalIndex)
+  {
+    return ((unsigned long long)regionId << 32) | nodeGlobalIndex;
+  }
+  // Fibonacci hashing, then linear probing up to the key or an empty slot
+  size_t Find(unsigned long long key) const
+  {
+    size_t mask = (size_t(1) << bits) - 1;
+    size_t slot = size_t((key * 0x9E3779B97F4A7C15ULL) >> (64 - bits));
+    while(entries[slot].key != key && entries[slot].key != emptyKey)
+    {
+      slot = (slot + 1) & mask;
+    }
+    return slot;
+  }
+  Entry *entries;
+  int bits;
+};
 
+  // Regions of the cells of a mesh, one per cell
+  struct CellRegionIds
+  {
+    const IndexType *cellRegionId;
+    IndexType operator()(IndexType cellIndex, IndexType) const
+    {
+      return cellRegionId[cellIndex];
+    }
+  };
 
-          for(IndexType srcRegionIndex = 0; srcRegionIndex < nodeInfo[nodeIndices[0]].incidentRegionsCount; srcRegionIndex++)
-          {
-            IndexType srcRegion = nodeInfo[nodeIndices[0]].incidentRegions[srcRegionIndex];
-            bool found = 0;
-            for(IndexType dstRegionIndex = 0; ((dstRegionIndex < nodeInfo[nodeIndices[1]].incidentRegionsCount) && !found); dstRegionIndex++)
-            {
-              if(nodeInfo[nodeIndices[1]].incidentRegions[dstRegionIndex] == srcRegion) found = 1;
-            }
-            if(!found) nodeInfo[nodeIndices[1]].incidentRegions[nodeInfo[nodeIndices[1]].incidentRegionsCount++] = srcRegion;
-          }
+  // Regions of the nodes of each cell, four per cell
+  struct CellNodeRegionIds
+  {
+    const IndexType *cellIndices;
+    const IndexType *nodeRegionId;
+    IndexType operator()(IndexType cellIndex, IndexType number) const
+    {
+      return nodeRegionId[cellIndices[4 * cellIndex + number]];
+    }
+  };
 
-          for(IndexType srcRegionIndex = 0; srcRegionIndex < nodeInfo[nodeIndices[1]].incidentRegionsCount; srcRegionIndex++)
-          {
-            IndexType srcRegion = nodeInfo[nodeIndices[1]].incidentRegions[srcRegionIndex];
-            bool found = 0;
-            for(IndexType dstRegionIndex = 0; ((dstRegionIndex < nodeInfo[nodeIndices[0]].incidentRegionsCount) && !found); dstRegionIndex++)
-            {
-              if(nodeInfo[nodeIndices[0]].incidentRegions[dstRegionIndex] == srcRegion) found = 1;
-            }
-            if(!found) nodeInfo[nodeIndices[0]].incidentRegions[nodeInfo[nodeIndices[0]].incidentRegionsCount++] = srcRegion;
-          }
-        }
-      }
+  // Regions incident to every node, kept in compressed rows. Each node
+  // lists its regions in the order the cells first bring them in, then
+  // the ones it gets across contact faces.
+  class RegionBuilder
+  {
+  public:
+    // Rows are kept in the given arena, or in an own one
+    RegionBuilder(int threads = 1, MemoryArena *arena = 0)
+    {
+      Reset(threads, arena);
+    }
+    // Drops the rows, leaving their memory to the arena they came from
+    void Reset(int threads = 1, MemoryArena *arena = 0)
+    {
+      ownArena.Release();
+      threadsCount = threads;
+      nodesCount = 0;
+      nodeOffsets = 0;
+      incidentRegions = 0;
+      storage = arena ? arena : &ownArena;
+    }
+    void LoadMesh(const IndexType *cellIndices, const IndexType *cellRegionId, IndexType cellsCount,
+                  ContactFace *contactFaces, IndexType contactFacesCount)
+    {
+      CellRegionIds cellRegions = {cellRegionId};
+      Build(cellIndices, cellsCount, 1, cellRegions, contactFaces, contactFacesCount);
     }
 
-    void LoadMeshByNodes(IndexType *cellIndices, IndexType *nodeRegionId, IndexType cellsCount,
+    void LoadMeshByNodes(const IndexType *cellIndices, const IndexType *nodeRegionId, IndexType cellsCount,
                   ContactFace *contactFaces, IndexType contactFacesCount)
+    {
+      CellNodeRegionIds cellRegions = {cellIndices, nodeRegionId};
+      Build(cellIndices, cellsCount, 4, cellRegions, contactFaces, contactFacesCount);
+    }
+    IndexType GetNodesCount()
+    {
+      return nodesCount;
+    }
+    void GetNodeRegions(IndexType nodeIndex, IndexType *incidentRegions)
+    {
+      if(nodeIndex >= nodesCount) return;
+      std::copy(GetNodeRegions(nodeIndex), GetNodeRegions(nodeIndex) + GetNodeRegionsCount(nodeIndex), incidentRegions);
+    }
+    const IndexType *GetNodeRegions(IndexType nodeIndex)
+    {
+      return incidentRegions + nodeOffsets[nodeIndex];
+    }
+    IndexType GetNodeRegionsCount(IndexType nodeIndex)
+    {
+      if(nodeIndex >= nodesCount) return 0;
+      return nodeOffsets[nodeIndex + 1] - nodeOffsets[nodeIndex];
+    }
+  private:
+    // Counting sort of the (node, region) pairs by node, stable in cell
+    // order, then every row drops its repeated regions on its own
+    template<typename CellRegions>
+    void Build(const IndexType *cellIndices, IndexType cellsCount, IndexType regionsPerCell, const CellRegions &cellRegions,
+               ContactFace *contactFaces, IndexType contactFacesCount)
     {
       nodesCount = 0;
       for(IndexType cellIndex = 0; cellIndex < cellsCount; cellIndex++)
@@ -192,88 +368,57 @@ private:
       }
       nodesCount++; //max index + 1
 
-      nodeInfo = new NodeInfo[nodesCount];
-
-      for(IndexType nodeIndex = 0; nodeIndex < nodesCount; nodeIndex++)
+      // Working arrays count towards the usage of the rows' arena
+      MemoryArena work(storage->GetUsage());
+      IndexType *offsets = work.Allocate<IndexType>(nodesCount + 1);
+      std::fill(offsets, offsets + nodesCount + 1, 0);
+      for(IndexType i = 0; i < cellsCount * 4; i++)
       {
-        nodeInfo[nodeIndex].incidentRegionsCount = 0;
-      }
-
-      IndexType totalIncidentRegionsCount = 0;
-
-      for(IndexType cellIndex = 0; cellIndex < cellsCount; cellIndex++)
-      {
-        IndexType cellRegionsCount = 1;
-        IndexType localRegions[4];
-        for(IndexType i = 0; i < 4; i++)
-        {
-          localRegions[i] = nodeRegionId[cellIndices[4 * cellIndex + i]];
-        }
-        std::sort(localRegions, localRegions + 4);
-        for(IndexType i = 0; i < 3; i++)
-        {
-          if(localRegions[i] != localRegions[i + 1]) cellRegionsCount++;
-        }
-
-        for(IndexType i = 0; i < 4; i++)
-        {
-          nodeInfo[cellIndices[4 * cellIndex + i]].incidentRegionsCount = cellRegionsCount;
-          totalIncidentRegionsCount += cellRegionsCount;
-        }
-      }
-
-      for(IndexType contactFaceIndex = 0; contactFaceIndex < contactFacesCount; contactFaceIndex++)
-      {
-        for(IndexType faceNode = 0; faceNode < 3; faceNode++)
-        {
-          IndexType nodeIndices[2];
-          nodeIndices[0] = contactFaces[contactFaceIndex].faces[0].nodes[faceNode];
-          nodeIndices[1] = contactFaces[contactFaceIndex].faces[1].nodes[faceNode];
-
-          IndexType count0 = nodeInfo[nodeIndices[0]].incidentRegionsCount;
-          IndexType count1 = nodeInfo[nodeIndices[1]].incidentRegionsCount;
-
-          nodeInfo[nodeIndices[0]].incidentRegionsCount += count1;
-          totalIncidentRegionsCount += count1;
-
-          nodeInfo[nodeIndices[1]].incidentRegionsCount += count0;
-          totalIncidentRegionsCount += count0;
-        }
+        offsets[cellIndices[i] + 1] += regionsPerCell;
       }
-
-      incidentRegionsPool = new IndexType[totalIncidentRegionsCount];
-      IndexType poolOffset = 0;
       for(IndexType nodeIndex = 0; nodeIndex < nodesCount; nodeIndex++)
       {
-        nodeInfo[nodeIndex].incidentRegions = incidentRegionsPool + poolOffset;
-        poolOffset += nodeInfo[nodeIndex].incidentRegionsCount;
-        nodeInfo[nodeIndex].incidentRegionsCount = 0; //will be recomputed later
+        offsets[nodeIndex + 1] += offsets[nodeIndex];
       }
-
-      for(IndexType cellIndex = 0; cellIndex < cellsCount; cellIndex++)
+      IndexType *regions = work.Allocate<IndexType>(offsets[nodesCount]);
       {
-        IndexType regionIds[4];
-        for(IndexType i = 0; i < 4; i++)
-        {
-          regionIds[i] = nodeRegionId[cellIndices[4 * cellIndex + i]];
-        }
-        for(IndexType regionNumber = 0; regionNumber < 4; regionNumber++)
+        MemoryArena nextArena(storage->GetUsage());
+        IndexType *next = nextArena.Allocate<IndexType>(nodesCount);
+        std::copy(offsets, offsets + nodesCount, next);
+        for(IndexType cellIndex = 0; cellIndex < cellsCount; cellIndex++)
         {
           for(IndexType i = 0; i < 4; i++)
           {
-            IndexType nodeIndex = cellIndices[4 * cellIndex + i];
-            bool found = 0;
-            for(IndexType regions = 0; ((regions < nodeInfo[nodeIndex].incidentRegionsCount) && !found); regions++)
+            IndexType nodeIndex = cellIndices[cellIndex * 4 + i];
+            for(IndexType number = 0; number < regionsPerCell; number++)
             {
-              if(nodeInfo[nodeIndex].incidentRegions[regions] == regionIds[regionNumber]) found = 1;
+              regions[next[nodeIndex]++] = cellRegions(cellIndex, number);
             }
-            if(!found) nodeInfo[nodeIndex].incidentRegions[nodeInfo[nodeIndex].incidentRegionsCount++] = regionIds[regionNumber];
           }
         }
       }
 
+      IndexType *counts = work.Allocate<IndexType>(nodesCount);
+      parallel_for(nodesCount, threadsCount, [&](int nodeIndex)
+      {
+        IndexType *row = regions + offsets[nodeIndex];
+        IndexType count = 0;
+        for(IndexType e = 0; e < offsets[nodeIndex + 1] - offsets[nodeIndex]; e++)
+        {
+          if(std::find(row, row + count, row[e]) == row + count) row[count++] = row[e];
+        }
+        counts[nodeIndex] = count;
+      }, 4096);
 
-
+      // Contact nodes share their regions with their counterparts across
+      // the contact, face after face
+      IndexType *contactRow = 0;
+      if(contactFacesCount)
+      {
+        contactRow = work.Allocate<IndexType>(nodesCount);
+        std::fill(contactRow, contactRow + nodesCount, IndexType(-1));
+      }
+      std::vector< std::vector<IndexType> > contactRegions;
       for(IndexType contactFaceIndex = 0; contactFaceIndex < contactFacesCount; contactFaceIndex++)
       {
         for(IndexType faceNode = 0; faceNode < 3; faceNode++)
@@ -281,68 +426,89 @@ private:
           IndexType nodeIndices[2];
           nodeIndices[0] = contactFaces[contactFaceIndex].faces[0].nodes[faceNode];
           nodeIndices[1] = contactFaces[contactFaceIndex].faces[1].nodes[faceNode];
-
-
-          for(IndexType srcRegionIndex = 0; srcRegionIndex < nodeInfo[nodeIndices[0]].incidentRegionsCount; srcRegionIndex++)
+          for(IndexType side = 0; side < 2; side++)
           {
-            IndexType srcRegion = nodeInfo[nodeIndices[0]].incidentRegions[srcRegionIndex];
-            bool found = 0;
-            for(IndexType dstRegionIndex = 0; ((dstRegionIndex < nodeInfo[nodeIndices[1]].incidentRegionsCount) && !found); dstRegionIndex++)
-            {
-              if(nodeInfo[nodeIndices[1]].incidentRegions[dstRegionIndex] == srcRegion) found = 1;
-            }
-            if(!found) nodeInfo[nodeIndices[1]].incidentRegions[nodeInfo[nodeIndices[1]].incidentRegionsCount++] = srcRegion;
+            if(contactRow[nodeIndices[side]] != IndexType(-1)) continue;
+            contactRow[nodeIndices[side]] = IndexType(contactRegions.size());
+            const IndexType *row = regions + offsets[nodeIndices[side]];
+            contactRegions.push_back(std::vector<IndexType>(row, row + counts[nodeIndices[side]]));
           }
-
-          for(IndexType srcRegionIndex = 0; srcRegionIndex < nodeInfo[nodeIndices[1]].incidentRegionsCount; srcRegionIndex++)
+          std::vector<IndexType> &regions0 = contactRegions[contactRow[nodeIndices[0]]];
+          std::vector<IndexType> &regions1 = contactRegions[contactRow[nodeIndices[1]]];
+          for(IndexType i = 0; i < IndexType(regions0.size()); i++)
           {
-            IndexType srcRegion = nodeInfo[nodeIndices[1]].incidentRegions[srcRegionIndex];
-            bool found = 0;
-            for(IndexType dstRegionIndex = 0; ((dstRegionIndex < nodeInfo[nodeIndices[0]].incidentRegionsCount) && !found); dstRegionIndex++)
-            {
-              if(nodeInfo[nodeIndices[0]].incidentRegions[dstRegionIndex] == srcRegion) found = 1;
-            }
-            if(!found) nodeInfo[nodeIndices[0]].incidentRegions[nodeInfo[nodeIndices[0]].incidentRegionsCount++] = srcRegion;
+            if(std::find(regions1.begin(), regions1.end(), regions0[i]) == regions1.end()) regions1.push_back(regions0[i]);
+          }
+          for(IndexType i = 0; i < IndexType(regions1.size()); i++)
+          {
+            if(std::find(regions0.begin(), regions0.end(), regions1[i]) == regions0.end()) regions0.push_back(regions1[i]);
           }
         }
       }
-    }
-    IndexType GetNodesCount()
-    {
-      return nodesCount;
-    }
-    void GetNodeRegions(IndexType nodeIndex, IndexType *incidentRegions)
-    {
-      if(nodeIndex >= nodesCount) return;
-      for( int_t i = 0; i < nodeInfo[nodeIndex].incidentRegionsCount; i++)
+      size_t contactBytes = contactRegions.capacity() * sizeof(std::vector<IndexType>);
+      for(IndexType contactIndex = 0; contactIndex < IndexType(contactRegions.size()); contactIndex++)
       {
-        incidentRegions[i] = nodeInfo[nodeIndex].incidentRegions[i];
+        contactBytes += contactRegions[contactIndex].capacity() * sizeof(IndexType);
       }
+      HeldBytes contactRegionsBytes(storage->GetUsage(), contactBytes);
+      for(IndexType nodeIndex = 0; contactRow && nodeIndex < nodesCount; nodeIndex++)
+      {
+        if(contactRow[nodeIndex] != IndexType(-1)) counts[nodeIndex] = IndexType(contactRegions[contactRow[nodeIndex]].size());
+      }
+
+      nodeOffsets = storage->Allocate<IndexType>(nodesCount + 1);
+      nodeOffsets[0] = 0;
+      for(IndexType nodeIndex = 0; nodeIndex < nodesCount; nodeIndex++)
+      {
+        nodeOffsets[nodeIndex + 1] = nodeOffsets[nodeIndex] + counts[nodeIndex];
+      }
+      incidentRegions = storage->Allocate<IndexType>(nodeOffsets[nodesCount]);
+      parallel_for(nodesCount, threadsCount, [&](int nodeIndex)
+      {
+        const IndexType *row = (contactRow && contactRow[nodeIndex] != IndexType(-1)) ?
+          contactRegions[contactRow[nodeIndex]].data() : regions + offsets[nodeIndex];
+        std::copy(row, row + counts[nodeIndex], incidentRegions + nodeOffsets[nodeIndex]);
+      }, 4096);
     }
-    IndexType GetNodeRegionsCount(IndexType nodeIndex)
-    {
-      if(nodeIndex >= nodesCount) return 0;
-      return nodeInfo[nodeIndex].incidentRegionsCount;
-    }
-  private:
-    struct NodeInfo
-    {
-      IndexType incidentRegionsCount;
-      IndexType *incidentRegions;
-    };
-    NodeInfo *nodeInfo;
-    IndexType nodesCount;
 
-    IndexType *incidentRegionsPool;
+    IndexType *nodeOffsets;
+    IndexType *incidentRegions;
+    IndexType nodesCount;
+    int threadsCount;
+    MemoryArena ownArena;
+    MemoryArena *storage;
   };
 
   class MeshSplitter
   {
   public:
-    MeshSplitter()
+    MeshSplitter() : storage(&arenaUsage), scratch(&arenaUsage)
     {
+      nodeOrder = node_order_none;
+      nodeCoords = 0;
+      threadsCount = 1;
+      cellBlocks = false;
+      meshesCount = 0;
     }
-    void LoadBaseMeshes(IndexType *cellIndices, IndexType *cellRegionId, IndexType cellsCount,
+
+    // Puts the own cells shared with no other region ahead of the shared
+    // ones in every local mesh, followed by the cells shared from other
+    // regions. Call before LoadBaseMeshes.
+    void SetCellBlocks(bool blocks)
+    {
+      cellBlocks = blocks;
+    }
+
+    // Renumbers the nodes of every local mesh in the given order and sorts
+    // its cells by their nodes. coords (x, y, z of every global node) are
+    // needed for node_order_hilbert. Call before LoadBaseMeshes.
+    void SetNodeOrder(node_order order, const REAL *coords, int threads)
+    {
+      nodeOrder = order;
+      nodeCoords = coords;
+      threadsCount = threads;
+    }
+    void LoadBaseMeshes(const IndexType *cellIndices, const IndexType *cellRegionId, IndexType cellsCount,
                         IndexType *subMeshNodesCount, IndexType subMeshesCount,
                         ContactFace *contactFaces, IndexType *contactFacesCount, IndexType contactTypesCount,
                         BoundaryFace *boundaryFaces, IndexType *boundaryFacesCount, IndexType boundaryTypesCount)
@@ -358,18 +524,21 @@ private:
       {
         totalBoundaryFacesCount += boundaryFacesCount[boundaryTypeIndex];
       }
+      // A splitter may be loaded again, dropping the previous meshes
+      storage.Release();
+      arenaUsage.peakBytes = arenaUsage.bytes.load();
+
       meshesCount = 0;
       for(IndexType cellIndex = 0; cellIndex < cellsCount; cellIndex++)
       {
         if(cellRegionId[cellIndex] > meshesCount) meshesCount = cellRegionId[cellIndex];
       }
       meshesCount++; //meshes count is one more than max meshid
-      localMeshes = new LocalMesh[meshesCount];
+      localMeshes = storage.Allocate<LocalMesh>(meshesCount);
 
       for(IndexType meshIndex = 0; meshIndex < meshesCount; meshIndex++)
       {
-        localMeshes[meshIndex].nodesCount = 0;
-        localMeshes[meshIndex].cellsCount = 0;
+        localMeshes[meshIndex] = LocalMesh();
       }
 
       /*IndexType lastIndex = 0;
@@ -388,18 +557,22 @@ private:
       ComputeTransitionNodes();
       ComputeSharedCellTransitionIndices();
       ComputeLocalNodeIndices();
+      ReorderLocalMeshes(subMeshNodesCount, subMeshesCount);
       ComputeLocalSubmeshes(subMeshNodesCount, subMeshesCount);
       ComputeLocalContactFaces(contactFaces, contactFacesCount, contactTypesCount);
       ComputeLocalBoundaryFaces(boundaryFaces, boundaryFacesCount, boundaryTypesCount);
+
+      expandedRegions.Reset();
+      nodeInfo = 0;
+      scratch.Release();
     }
-    ~MeshSplitter()
+
+    // Most bytes the splitter held at once during the last LoadBaseMeshes:
+    // its arenas, the vectors its steps keep outside them, and a bound of
+    // what the node ordering holds
+    size_t PeakBytes()
     {
-      delete [] nodeGlobalIndicesPool;
-      delete [] incidentRegionIdPool;
-      delete [] localIndexPool;
-      delete [] nodeInfo;
-      delete [] cellGlobalIndicesPool;
-      delete [] localMeshes;
+      return arenaUsage.peakBytes;
     }
 
     IndexType GetMeshesCount()
@@ -415,6 +588,16 @@ private:
     {
       return localMeshes[regionId].cellsCount;
     }
+    // Own cells no other region shares, the first ones with cell blocks
+    IndexType GetInteriorCellsCount(IndexType regionId)
+    {
+      return localMeshes[regionId].interiorCellsCount;
+    }
+    // Cells of the region itself, ahead of the ones shared from others
+    IndexType GetOwnCellsCount(IndexType regionId)
+    {
+      return localMeshes[regionId].ownCellsCount;
+    }
 
     void GetCellLocalIndices(IndexType regionId, IndexType *cellLocalIndices)
     {
@@ -497,7 +680,7 @@ private:
 
     IndexType GetSharedRegionsCount   (IndexType regionId)
     {
-      return IndexType(localMeshes[regionId].destRegionId.size());
+      return localMeshes[regionId].sharedRegionsCount;
     }
 
     IndexType GetSharedRegionDstRegionId(IndexType regionId, IndexType regionIndex)
@@ -545,208 +728,174 @@ private:
 
     IndexType GetNodeLocalIndex(IndexType regionId, IndexType nodeGlobalIndex)
     {
-      for(IndexType incidentRegion = 0; incidentRegion < nodeInfo[nodeGlobalIndex].incidentRegionsCount; incidentRegion++)
-      {
-        if(nodeInfo[nodeGlobalIndex].incindentRegionId[incidentRegion] == regionId)
-        {
-          return nodeInfo[nodeGlobalIndex].localIndex[incidentRegion];
-        }
-      }
-      return -1;
+      return nodeLocalIndices.Get(regionId, nodeGlobalIndex);
+    }
+
+    void SetNodeLocalIndex(IndexType regionId, IndexType nodeGlobalIndex, IndexType localIndex)
+    {
+      nodeLocalIndices.Update(regionId, nodeGlobalIndex, localIndex);
     }
 
 
+    // A shared cell, copied from the region of the cell to dstRegion
+    struct SharedCell
+    {
+      IndexType cellIndex;
+      IndexType dstRegion;
+      IndexType slot; // position in the shared cells of the source region
+    };
+
+    // Cells go to every region holding one of their nodes. Blocks of cells
+    // gather their shared copies in parallel, each into its own buffer, so
+    // the copies stay in cell order whatever thread runs a block.
     void ComputeExpandedIndices(
-      IndexType *cellIndices, IndexType *cellRegionId, IndexType cellsCount,
+      const IndexType *cellIndices, const IndexType *cellRegionId, IndexType cellsCount,
       ContactFace *contactFaces, IndexType contactFacesCount)
     {
-      RegionBuilder *regionBuilder = new RegionBuilder();
-      regionBuilder->LoadMesh(cellIndices, cellRegionId, cellsCount, contactFaces, contactFacesCount);
-      IndexType *cellRegions = new IndexType[meshesCount];
-      IndexType *nodeRegions = new IndexType[meshesCount];
-
-      IndexType sharedCellsTotalCount = 0;
-      //IndexType sharedRegionsTotalCount = 0;
-      for(IndexType cellIndex = 0; cellIndex < cellsCount; cellIndex++)
+      MemoryArena regionsArena(&arenaUsage);
+      RegionBuilder regionBuilder(threadsCount, &regionsArena);
+      regionBuilder.LoadMesh(cellIndices, cellRegionId, cellsCount, contactFaces, contactFacesCount);
+
+      const IndexType blockSize = 1 << 14;
+      IndexType blocksCount = (cellsCount + blockSize - 1) / blockSize;
+      std::vector< std::vector<SharedCell> > blockSharedCells(blocksCount);
+      parallel_for(blocksCount, threadsCount, [&](int blockIndex)
       {
-        IndexType cellRegionsCount = 0;
-        for(IndexType i = 0; i < 4; i++)
+        std::vector<IndexType> cellRegions;
+        IndexType end = std::min(cellsCount, (blockIndex + 1) * blockSize);
+        for(IndexType cellIndex = blockIndex * blockSize; cellIndex < end; cellIndex++)
         {
-          IndexType nodeIndex = cellIndices[cellIndex * 4 + i];
-
-          IndexType nodeRegionsCount = regionBuilder->GetNodeRegionsCount(nodeIndex);
-          regionBuilder->GetNodeRegions(nodeIndex, nodeRegions);
-
-          for(IndexType nodeRegionIndex = 0; nodeRegionIndex < nodeRegionsCount; nodeRegionIndex++)
+          cellRegions.clear();
+          for(IndexType i = 0; i < 4; i++)
           {
-            bool found = 0;
-            for(IndexType cellRegionIndex = 0; ((cellRegionIndex < cellRegionsCount) && (!found)); cellRegionIndex++)
+            IndexType nodeIndex = cellIndices[cellIndex * 4 + i];
+            const IndexType *nodeRegions = regionBuilder.GetNodeRegions(nodeIndex);
+            for(IndexType nodeRegionIndex = 0; nodeRegionIndex < regionBuilder.GetNodeRegionsCount(nodeIndex); nodeRegionIndex++)
             {
-              if(nodeRegions[nodeRegionIndex] == cellRegions[cellRegionIndex])
-                found = 1;
+              if(std::find(cellRegions.begin(), cellRegions.end(), nodeRegions[nodeRegionIndex]) == cellRegions.end())
+                cellRegions.push_back(nodeRegions[nodeRegionIndex]);
             }
-            if(!found) cellRegions[cellRegionsCount++] = nodeRegions[nodeRegionIndex];
           }
-        }
-
-        IndexType sourceRegion = cellRegionId[cellIndex];;//-1;
-
-        if(sourceRegion != -1)
-        {
-          for(IndexType regionIndex = 0; regionIndex < cellRegionsCount; regionIndex++)
+          for(IndexType regionIndex = 0; regionIndex < IndexType(cellRegions.size()); regionIndex++)
           {
-            if(sourceRegion != cellRegions[regionIndex])
+            if(cellRegions[regionIndex] != cellRegionId[cellIndex])
             {
-              bool found = 0;
-              IndexType dstRegion = 0;
-              for(IndexType dstRegionIndex = 0; dstRegionIndex < IndexType(localMeshes[sourceRegion].destRegionId.size()); dstRegionIndex++)
-              {
-                if(localMeshes[sourceRegion].destRegionId[dstRegionIndex] == cellRegions[regionIndex])
-                {
-                  dstRegion = dstRegionIndex;
-                  found = 1;
-                  break;
-                }
-              }
-              if(!found)
-              {
-                dstRegion = IndexType(localMeshes[sourceRegion].destRegionId.size());
-                localMeshes[sourceRegion].destRegionId.push_back(cellRegions[regionIndex]);
-                localMeshes[sourceRegion].transitionNodesCount.push_back(0);
-                localMeshes[sourceRegion].sharedCellsCount.push_back(0);
-              }
-
-              localMeshes[sourceRegion].sharedCellsCount[dstRegion]++;
-              sharedCellsTotalCount++;
+              SharedCell sharedCell = {cellIndex, cellRegions[regionIndex], 0};
+              blockSharedCells[blockIndex].push_back(sharedCell);
             }
           }
-        }else
-        {
-          //something's wrong
         }
+      });
+      regionBuilder.Reset();
+      regionsArena.Release();
+      size_t sharedCellsBytes = blockSharedCells.capacity() * sizeof(std::vector<SharedCell>);
+      for(IndexType blockIndex = 0; blockIndex < blocksCount; blockIndex++)
+      {
+        sharedCellsBytes += blockSharedCells[blockIndex].capacity() * sizeof(SharedCell);
       }
-
-      sharedCellsGlobalIndicesPool = new IndexType[sharedCellsTotalCount * 4];
-      sharedCellsTransitionIndicesPool = new IndexType[sharedCellsTotalCount * 4];
-
-      IndexType offset = 0;
-
-      for(IndexType meshIndex = 0; meshIndex < meshesCount; meshIndex++)
+      HeldBytes blockSharedCellsBytes(&arenaUsage, sharedCellsBytes);
+
+      // Destination regions are numbered in the order cells first reach
+      // them, and every shared cell gets its place among those of its
+      // source and destination
+      std::vector< std::vector<IndexType> > destRegionId(meshesCount);
+      std::vector< std::vector<IndexType> > sharedCellsCount(meshesCount);
+      std::vector<IndexType> blockOffsets(blocksCount + 1, 0);
+      for(IndexType blockIndex = 0; blockIndex < blocksCount; blockIndex++)
       {
-        localMeshes[meshIndex].sharedCellsGlobalIndices = new IndexType*[localMeshes[meshIndex].destRegionId.size()];
-        localMeshes[meshIndex].sharedCellsTransitionIndices = new IndexType*[localMeshes[meshIndex].destRegionId.size()];
-
-        for(IndexType dstRegion = 0; dstRegion < IndexType(localMeshes[meshIndex].destRegionId.size()); dstRegion++)
+        for(IndexType index = 0; index < IndexType(blockSharedCells[blockIndex].size()); index++)
         {
-          localMeshes[meshIndex].sharedCellsGlobalIndices[dstRegion] = sharedCellsGlobalIndicesPool + offset * 4;
-          localMeshes[meshIndex].sharedCellsTransitionIndices[dstRegion] = sharedCellsTransitionIndicesPool + offset * 4;
-
-          offset += localMeshes[meshIndex].sharedCellsCount[dstRegion];
-          localMeshes[meshIndex].sharedCellsCount[dstRegion] = 0; //will be recomputed
+          SharedCell &sharedCell = blockSharedCells[blockIndex][index];
+          IndexType sourceRegion = cellRegionId[sharedCell.cellIndex];
+          IndexType dstRegion = IndexType(std::find(destRegionId[sourceRegion].begin(), destRegionId[sourceRegion].end(), sharedCell.dstRegion) -
+                                          destRegionId[sourceRegion].begin());
+          if(dstRegion == IndexType(destRegionId[sourceRegion].size()))
+          {
+            destRegionId[sourceRegion].push_back(sharedCell.dstRegion);
+            sharedCellsCount[sourceRegion].push_back(0);
+          }
+          sharedCell.slot = dstRegion;
+          sharedCellsCount[sourceRegion][dstRegion]++;
         }
+        blockOffsets[blockIndex + 1] = blockOffsets[blockIndex] + IndexType(blockSharedCells[blockIndex].size());
       }
+      IndexType sharedCellsTotalCount = blockOffsets[blocksCount];
 
-      normalCellsCount = cellsCount;
-      expandedCellsCount = cellsCount + sharedCellsTotalCount;
-
-      expandedCellIndices = new IndexType[expandedCellsCount * 4];
-      expandedCellRegionId = new IndexType[expandedCellsCount];
-
-      expandedCellsCount = cellsCount; //will be expanded further
+      IndexType regionPairsCount = 0;
+      for(IndexType meshIndex = 0; meshIndex < meshesCount; meshIndex++)
+      {
+        regionPairsCount += IndexType(destRegionId[meshIndex].size());
+      }
+      IndexType *destRegionIdPool = storage.Allocate<IndexType>(regionPairsCount);
+      IndexType *sharedCellsCountPool = storage.Allocate<IndexType>(regionPairsCount);
+      IndexType *transitionNodesCountPool = storage.Allocate<IndexType>(regionPairsCount);
+      IndexType **sharedCellsGlobalIndicesPointers = scratch.Allocate<IndexType*>(regionPairsCount);
+      IndexType **sharedCellsTransitionIndicesPointers = storage.Allocate<IndexType*>(regionPairsCount);
+      IndexType **transitionNodesGlobalIndicesPointers = storage.Allocate<IndexType*>(regionPairsCount);
 
+      sharedCellsGlobalIndicesPool = scratch.Allocate<IndexType>(sharedCellsTotalCount * 4);
+      sharedCellsTransitionIndicesPool = storage.Allocate<IndexType>(sharedCellsTotalCount * 4);
 
-      for(IndexType cellIndex = 0; cellIndex < cellsCount; cellIndex++)
+      std::vector< std::vector<IndexType> > sharedCellsOffset(meshesCount);
+      IndexType offset = 0;
+      IndexType pairOffset = 0;
+      for(IndexType meshIndex = 0; meshIndex < meshesCount; meshIndex++)
       {
-        for(IndexType i = 0; i < 4; i++)
+        LocalMesh &localMesh = localMeshes[meshIndex];
+        localMesh.sharedRegionsCount = IndexType(destRegionId[meshIndex].size());
+        localMesh.destRegionId = destRegionIdPool + pairOffset;
+        localMesh.sharedCellsCount = sharedCellsCountPool + pairOffset;
+        localMesh.transitionNodesCount = transitionNodesCountPool + pairOffset;
+        localMesh.sharedCellsGlobalIndices = sharedCellsGlobalIndicesPointers + pairOffset;
+        localMesh.sharedCellsTransitionIndices = sharedCellsTransitionIndicesPointers + pairOffset;
+        localMesh.transitionNodesGlobalIndices = transitionNodesGlobalIndicesPointers + pairOffset;
+        pairOffset += localMesh.sharedRegionsCount;
+
+        for(IndexType dstRegion = 0; dstRegion < localMesh.sharedRegionsCount; dstRegion++)
         {
-          expandedCellIndices[cellIndex * 4 + i] = cellIndices[cellIndex * 4 + i];
+          localMesh.destRegionId[dstRegion] = destRegionId[meshIndex][dstRegion];
+          localMesh.sharedCellsCount[dstRegion] = sharedCellsCount[meshIndex][dstRegion];
+          localMesh.transitionNodesCount[dstRegion] = 0;
+          localMesh.sharedCellsGlobalIndices[dstRegion] = sharedCellsGlobalIndicesPool + offset * 4;
+          localMesh.sharedCellsTransitionIndices[dstRegion] = sharedCellsTransitionIndicesPool + offset * 4;
+          sharedCellsOffset[meshIndex].push_back(offset);
+          offset += localMesh.sharedCellsCount[dstRegion];
         }
-        expandedCellRegionId[cellIndex] = cellRegionId[cellIndex];
       }
-
-      for(IndexType cellIndex = 0; cellIndex < cellsCount; cellIndex++)
+      for(IndexType blockIndex = 0; blockIndex < blocksCount; blockIndex++)
       {
-        //debug
-        {
-          int matches = 0;
-          for(IndexType i = 0; i < 4; i++)
-          {
-            if(cellIndices[cellIndex * 4 + i] == 3950) matches++;
-            if(cellIndices[cellIndex * 4 + i] == 5631) matches++;
-            if(cellIndices[cellIndex * 4 + i] == 5632) matches++;
-          }
-          if (matches == 3)
-          {
-            //int pp = 1;
-          }
-        }//debug
-        IndexType cellRegionsCount = 0;
-        for(IndexType i = 0; i < 4; i++)
+        for(IndexType index = 0; index < IndexType(blockSharedCells[blockIndex].size()); index++)
         {
-          IndexType nodeIndex = cellIndices[cellIndex * 4 + i];
+          SharedCell &sharedCell = blockSharedCells[blockIndex][index];
+          sharedCell.slot = sharedCellsOffset[cellRegionId[sharedCell.cellIndex]][sharedCell.slot]++;
+        }
+      }
 
-          IndexType nodeRegionsCount = regionBuilder->GetNodeRegionsCount(nodeIndex);
-          regionBuilder->GetNodeRegions(nodeIndex, nodeRegions);
+      normalCellsCount = cellsCount;
+      expandedCellsCount = cellsCount + sharedCellsTotalCount;
 
-          for(IndexType nodeRegionIndex = 0; nodeRegionIndex < nodeRegionsCount; nodeRegionIndex++)
-          {
-            bool found = 0;
-            for(IndexType cellRegionIndex = 0; ((cellRegionIndex < cellRegionsCount) && (!found)); cellRegionIndex++)
-            {
-              if(nodeRegions[nodeRegionIndex] == cellRegions[cellRegionIndex])
-                found = 1;
-            }
-            if(!found) cellRegions[cellRegionsCount++] = nodeRegions[nodeRegionIndex];
-          }
-        }
+      expandedCellIndices = scratch.Allocate<IndexType>(expandedCellsCount * 4);
+      expandedCellRegionId = scratch.Allocate<IndexType>(expandedCellsCount);
+      isSharedCell = scratch.Allocate<char>(cellsCount);
+      std::fill(isSharedCell, isSharedCell + cellsCount, 0);
 
-        IndexType sourceRegion = cellRegionId[cellIndex];//-1;
-        if(sourceRegion != -1)
+      std::copy(cellIndices, cellIndices + cellsCount * 4, expandedCellIndices);
+      std::copy(cellRegionId, cellRegionId + cellsCount, expandedCellRegionId);
+      parallel_for(blocksCount, threadsCount, [&](int blockIndex)
+      {
+        for(IndexType index = 0; index < IndexType(blockSharedCells[blockIndex].size()); index++)
         {
-          for(IndexType regionIndex = 0; regionIndex < cellRegionsCount; regionIndex++)
+          const SharedCell &sharedCell = blockSharedCells[blockIndex][index];
+          IndexType expandedCellIndex = cellsCount + blockOffsets[blockIndex] + index;
+          for(IndexType i = 0; i < 4; i++)
           {
-            if(sourceRegion != cellRegions[regionIndex])
-            {
-              bool found = 0;
-              IndexType dstRegion = 0;
-              for(IndexType dstRegionIndex = 0; dstRegionIndex < IndexType(localMeshes[sourceRegion].destRegionId.size()); dstRegionIndex++)
-              {
-                if(localMeshes[sourceRegion].destRegionId[dstRegionIndex] == cellRegions[regionIndex])
-                {
-                  dstRegion = dstRegionIndex;
-                  found = 1;
-                  break;
-                }
-              }
-              if(!found)
-              {
-                assert(0);
-              }
-
-
-              for(IndexType i = 0; i < 4; i++)
-              {
-                expandedCellIndices[expandedCellsCount * 4 + i] = cellIndices[cellIndex * 4 + i];
-
-                localMeshes[sourceRegion].sharedCellsGlobalIndices[dstRegion][localMeshes[sourceRegion].sharedCellsCount[dstRegion] * 4 + i] =
-                  cellIndices[cellIndex * 4 + i];
-              }
-
-              expandedCellRegionId[expandedCellsCount] = cellRegions[regionIndex];
-              expandedCellsCount++;
-
-              localMeshes[sourceRegion].sharedCellsCount[dstRegion]++;
-            }
+            expandedCellIndices[expandedCellIndex * 4 + i] = cellIndices[sharedCell.cellIndex * 4 + i];
+            sharedCellsGlobalIndicesPool[sharedCell.slot * 4 + i] = cellIndices[sharedCell.cellIndex * 4 + i];
           }
-        }else
-        {
-          assert(0);
+          expandedCellRegionId[expandedCellIndex] = sharedCell.dstRegion;
+          isSharedCell[sharedCell.cellIndex] = 1;
         }
-      }
-
-      delete [] nodeRegions;
-      delete [] cellRegions;
-      delete regionBuilder;
+      });
     }
 
 
@@ -758,7 +907,7 @@ private:
         localMeshes[expandedCellRegionId[cellIndex]].cellsCount++;
         cellGlobalIndicesPoolSize++;
       }
-      cellGlobalIndicesPool = new IndexType[cellGlobalIndicesPoolSize * 4];
+      cellGlobalIndicesPool = storage.Allocate<IndexType>(cellGlobalIndicesPoolSize * 4);
 
       IndexType offset = 0;
       for(IndexType meshIndex = 0; meshIndex < meshesCount; meshIndex++)
@@ -768,13 +917,30 @@ private:
         localMeshes[meshIndex].cellsCount = 0; //will be restored
       }
 
-      for(IndexType cellIndex = 0; cellIndex < expandedCellsCount; cellIndex++)
+      for(IndexType cellIndex = 0; cellIndex < normalCellsCount; cellIndex++)
       {
-        for(IndexType i = 0; i < 4; i++)
+        localMeshes[expandedCellRegionId[cellIndex]].ownCellsCount++;
+        if(!isSharedCell[cellIndex]) localMeshes[expandedCellRegionId[cellIndex]].interiorCellsCount++;
+      }
+
+      // With cell blocks the interior cells go first, then the shared own
+      // cells, then the cells of other regions; otherwise the own cells
+      // keep their order
+      for(int pass = 0; pass < 3; pass++)
+      {
+        IndexType begin = (pass < 2) ? 0 : normalCellsCount;
+        IndexType end = (pass < 2) ? normalCellsCount : expandedCellsCount;
+        if(!cellBlocks && pass == 1) continue;
+        for(IndexType cellIndex = begin; cellIndex < end; cellIndex++)
         {
-          localMeshes[expandedCellRegionId[cellIndex]].cellGlobalIndices[localMeshes[expandedCellRegionId[cellIndex]].cellsCount * 4 + i] = expandedCellIndices[cellIndex * 4 + i];
+          if(cellBlocks && pass < 2 && isSharedCell[cellIndex] != pass) continue;
+          LocalMesh &localMesh = localMeshes[expandedCellRegionId[cellIndex]];
+          for(IndexType i = 0; i < 4; i++)
+          {
+            localMesh.cellGlobalIndices[localMesh.cellsCount * 4 + i] = expandedCellIndices[cellIndex * 4 + i];
+          }
+          localMesh.cellsCount++;
         }
-        localMeshes[expandedCellRegionId[cellIndex]].cellsCount++;
       }
     }
 
@@ -782,49 +948,33 @@ private:
 
     void ComputeNodeInfo()
     {
-      RegionBuilder *regionBuilder = new RegionBuilder();
-      regionBuilder->LoadMesh(expandedCellIndices, expandedCellRegionId, expandedCellsCount, 0, 0);
+      // The node info refers to the rows of the expanded mesh regions
+      expandedRegions.Reset(threadsCount, &scratch);
+      expandedRegions.LoadMesh(expandedCellIndices, expandedCellRegionId, expandedCellsCount, 0, 0);
 
-      nodesCount = regionBuilder->GetNodesCount();
-      nodeInfo = new NodeInfo[nodesCount];
+      nodesCount = expandedRegions.GetNodesCount();
+      nodeInfo = scratch.Allocate<NodeInfo>(nodesCount);
 
       IndexType nodeInfoPoolSize = 0;
       for(IndexType nodeIndex = 0; nodeIndex < nodesCount; nodeIndex++)
       {
-        nodeInfo[nodeIndex].incidentRegionsCount = regionBuilder->GetNodeRegionsCount(nodeIndex);
+        nodeInfo[nodeIndex].incidentRegionsCount = expandedRegions.GetNodeRegionsCount(nodeIndex);
+        nodeInfo[nodeIndex].incindentRegionId = expandedRegions.GetNodeRegions(nodeIndex);
         nodeInfoPoolSize += nodeInfo[nodeIndex].incidentRegionsCount;
       }
+      nodeLocalIndices.Reserve(nodeInfoPoolSize, storage);
 
-      incidentRegionIdPool = new IndexType[nodeInfoPoolSize];
-      localIndexPool = new IndexType[nodeInfoPoolSize];
-
-      IndexType offset = 0;
-
-      for(IndexType nodeIndex = 0; nodeIndex < nodesCount; nodeIndex++)
-      {
-        nodeInfo[nodeIndex].incindentRegionId = incidentRegionIdPool + offset;
-        nodeInfo[nodeIndex].localIndex = localIndexPool + offset;
-        offset += nodeInfo[nodeIndex].incidentRegionsCount;
-
-        regionBuilder->GetNodeRegions(nodeIndex, nodeInfo[nodeIndex].incindentRegionId);
-      }
-
-      IndexType *maxMeshNodeIndex = new IndexType[meshesCount];
-      for(IndexType meshIndex = 0; meshIndex < meshesCount; meshIndex++)
-      {
-        maxMeshNodeIndex[meshIndex] = 0;
-      }
+      std::vector<IndexType> maxMeshNodeIndex(meshesCount, 0);
 
       for(IndexType nodeIndex = 0; nodeIndex < nodesCount; nodeIndex++)
       {
         for(IndexType incidentRegion = 0; incidentRegion < nodeInfo[nodeIndex].incidentRegionsCount; incidentRegion++)
         {
           IndexType incidentRegionIndex = nodeInfo[nodeIndex].incindentRegionId[incidentRegion];
-          nodeInfo[nodeIndex].localIndex[incidentRegion] = maxMeshNodeIndex[incidentRegionIndex];
+          nodeLocalIndices.Insert(incidentRegionIndex, nodeIndex, maxMeshNodeIndex[incidentRegionIndex]);
           maxMeshNodeIndex[incidentRegionIndex]++;
         }
       }
-      delete maxMeshNodeIndex;
 
       /*for(IndexType nodeIndex = 0; nodeIndex < nodesCount; nodeIndex++)
       {
@@ -834,73 +984,75 @@ private:
           localMesh[incidentRegionIndex].nodesCount++;
         }
       }*/
-
-      delete regionBuilder;
     }
 
+    // Nodes of the cells each region shares with another, sorted and
+    // unique. Region pairs are independent: each sorts its nodes in its own
+    // stretch of a working array, and the stretches are then packed into
+    // the pool.
     void ComputeTransitionNodes()
     {
-      IndexType transitionNodesPoolSize = 0;
+      IndexType regionPairsCount = 0;
       for(IndexType srcMeshIndex = 0; srcMeshIndex < meshesCount; srcMeshIndex++)
       {
-        for(IndexType dstMesh = 0; dstMesh < IndexType(localMeshes[srcMeshIndex].destRegionId.size()); dstMesh++)
-        {
-          //IndexType dstMeshIndex = localMeshes[srcMeshIndex].destRegionId[dstMesh];
-          DuplicateRemover<IndexType> nodeFinder;
-
-          for(IndexType cellIndex = 0; cellIndex < localMeshes[srcMeshIndex].sharedCellsCount[dstMesh]; cellIndex++)
-          {
-            for(int i = 0; i < 4; i++)
-              nodeFinder.AddElement(localMeshes[srcMeshIndex].sharedCellsGlobalIndices[dstMesh][4 * cellIndex + i]);
-          }
-          nodeFinder.RemoveDuplicates();
-
-          localMeshes[srcMeshIndex].transitionNodesCount[dstMesh] = nodeFinder.GetElementsCount();
-          transitionNodesPoolSize += localMeshes[srcMeshIndex].transitionNodesCount[dstMesh];
-        }
+        regionPairsCount += localMeshes[srcMeshIndex].sharedRegionsCount;
       }
-
-      transitionNodesGlobalIndicesPool = new IndexType[transitionNodesPoolSize];
-
-      IndexType offset = 0;
+      MemoryArena pairsArena(&arenaUsage);
+      IndexType *pairSrcMesh = pairsArena.Allocate<IndexType>(regionPairsCount);
+      IndexType *pairDstMesh = pairsArena.Allocate<IndexType>(regionPairsCount);
+      IndexType *pairOffsets = pairsArena.Allocate<IndexType>(regionPairsCount + 1);
+      IndexType nextPair = 0;
+      pairOffsets[0] = 0;
       for(IndexType srcMeshIndex = 0; srcMeshIndex < meshesCount; srcMeshIndex++)
       {
-        localMeshes[srcMeshIndex].transitionNodesGlobalIndices = new IndexType*[localMeshes[srcMeshIndex].destRegionId.size()];
-        for(IndexType dstMesh = 0; dstMesh < IndexType(localMeshes[srcMeshIndex].destRegionId.size()); dstMesh++)
+        for(IndexType dstMesh = 0; dstMesh < localMeshes[srcMeshIndex].sharedRegionsCount; dstMesh++)
         {
-          localMeshes[srcMeshIndex].transitionNodesGlobalIndices[dstMesh] = transitionNodesGlobalIndicesPool + offset;
-          offset += localMeshes[srcMeshIndex].transitionNodesCount[dstMesh];
+          pairSrcMesh[nextPair] = srcMeshIndex;
+          pairDstMesh[nextPair] = dstMesh;
+          pairOffsets[nextPair + 1] = pairOffsets[nextPair] + localMeshes[srcMeshIndex].sharedCellsCount[dstMesh] * 4;
+          nextPair++;
         }
       }
 
+      IndexType *pairNodes = pairsArena.Allocate<IndexType>(pairOffsets[regionPairsCount]);
 
-      for(IndexType srcMeshIndex = 0; srcMeshIndex < meshesCount; srcMeshIndex++)
+      parallel_for(regionPairsCount, threadsCount, [&](int pairIndex)
       {
-        for(IndexType dstMesh = 0; dstMesh < IndexType(localMeshes[srcMeshIndex].destRegionId.size()); dstMesh++)
-        {
-          //IndexType dstMeshIndex = localMeshes[srcMeshIndex].destRegionId[dstMesh];
-          DuplicateRemover<IndexType> nodeFinder;
-
-          for(IndexType cellIndex = 0; cellIndex < localMeshes[srcMeshIndex].sharedCellsCount[dstMesh]; cellIndex++)
-          {
-            for(int i = 0; i < 4; i++)
-              nodeFinder.AddElement(localMeshes[srcMeshIndex].sharedCellsGlobalIndices[dstMesh][4 * cellIndex + i]);
-          }
-          nodeFinder.RemoveDuplicates();
-
-          for(IndexType transitionNode = 0; transitionNode < nodeFinder.GetElementsCount(); transitionNode++)
-          {
-            localMeshes[srcMeshIndex].transitionNodesGlobalIndices[dstMesh][transitionNode] = nodeFinder[transitionNode];
-          }
-        }
+        LocalMesh &srcMesh = localMeshes[pairSrcMesh[pairIndex]];
+        IndexType dstMesh = pairDstMesh[pairIndex];
+        IndexType *nodes = pairNodes + pairOffsets[pairIndex];
+        IndexType count = pairOffsets[pairIndex + 1] - pairOffsets[pairIndex];
+        std::copy(srcMesh.sharedCellsGlobalIndices[dstMesh], srcMesh.sharedCellsGlobalIndices[dstMesh] + count, nodes);
+        HeldBytes bufferBytes(&arenaUsage, count * sizeof(IndexType));
+        std::vector<IndexType> buffer;
+        RadixSort(nodes, count, buffer);
+        srcMesh.transitionNodesCount[dstMesh] = IndexType(std::unique(nodes, nodes + count) - nodes);
+      });
+
+      IndexType *packedOffsets = pairsArena.Allocate<IndexType>(regionPairsCount + 1);
+      packedOffsets[0] = 0;
+      for(IndexType pairIndex = 0; pairIndex < regionPairsCount; pairIndex++)
+      {
+        packedOffsets[pairIndex + 1] = packedOffsets[pairIndex] +
+          localMeshes[pairSrcMesh[pairIndex]].transitionNodesCount[pairDstMesh[pairIndex]];
       }
+      transitionNodesGlobalIndicesPool = storage.Allocate<IndexType>(packedOffsets[regionPairsCount]);
+
+      parallel_for(regionPairsCount, threadsCount, [&](int pairIndex)
+      {
+        LocalMesh &srcMesh = localMeshes[pairSrcMesh[pairIndex]];
+        IndexType dstMesh = pairDstMesh[pairIndex];
+        const IndexType *nodes = pairNodes + pairOffsets[pairIndex];
+        srcMesh.transitionNodesGlobalIndices[dstMesh] = transitionNodesGlobalIndicesPool + packedOffsets[pairIndex];
+        std::copy(nodes, nodes + srcMesh.transitionNodesCount[dstMesh], srcMesh.transitionNodesGlobalIndices[dstMesh]);
+      });
     }
 
     void ComputeSharedCellTransitionIndices()
     {
       for(IndexType srcMeshIndex = 0; srcMeshIndex < meshesCount; srcMeshIndex++)
       {
-        for(IndexType dstMesh = 0; dstMesh < IndexType(localMeshes[srcMeshIndex].destRegionId.size()); dstMesh++)
+        for(IndexType dstMesh = 0; dstMesh < localMeshes[srcMeshIndex].sharedRegionsCount; dstMesh++)
         {
           for(IndexType transitionNode = 0; transitionNode < localMeshes[srcMeshIndex].transitionNodesCount[dstMesh]; transitionNode++)
           {
@@ -932,7 +1084,7 @@ private:
         }
       }
 
-      nodeGlobalIndicesPool = new IndexType[nodeGlobalIndicesPoolSize];
+      nodeGlobalIndicesPool = storage.Allocate<IndexType>(nodeGlobalIndicesPoolSize);
 
       IndexType offset = 0;
       for(IndexType meshIndex = 0; meshIndex < meshesCount; meshIndex++)
@@ -946,18 +1098,109 @@ private:
         for(IndexType incidentRegion = 0; incidentRegion < nodeInfo[nodeIndex].incidentRegionsCount; incidentRegion++)
         {
           IndexType incidentRegionIndex = nodeInfo[nodeIndex].incindentRegionId[incidentRegion];
-          IndexType nodeLocalIndex = nodeInfo[nodeIndex].localIndex[incidentRegion];
+          IndexType nodeLocalIndex = GetNodeLocalIndex(incidentRegionIndex, nodeIndex);
           localMeshes[incidentRegionIndex].nodeGlobalIndices[nodeLocalIndex] = nodeIndex;
         }
       }
     }
 
+    // Local meshes are independent, each is renumbered by its own thread
+    void ReorderLocalMeshes(IndexType *subMeshNodesCount, IndexType subMeshesCount)
+    {
+      if(nodeOrder == node_order_none) return;
+      std::vector<IndexType> subMeshEnd(subMeshNodesCount, subMeshNodesCount + subMeshesCount);
+      for(IndexType subMeshIndex = 1; subMeshIndex < subMeshesCount; subMeshIndex++)
+      {
+        subMeshEnd[subMeshIndex] += subMeshEnd[subMeshIndex - 1];
+      }
+      parallel_for(meshesCount, threadsCount, [&](int meshIndex)
+      {
+        ReorderLocalMesh(meshIndex, subMeshEnd);
+      });
+    }
+
+    // Nodes of a submesh stay a contiguous block, cells are sorted inside
+    // the interior, own and shared blocks
+    void ReorderLocalMesh(IndexType meshIndex, const std::vector<IndexType> &subMeshEnd)
+    {
+      LocalMesh &localMesh = localMeshes[meshIndex];
+      IndexType localNodesCount = localMesh.nodesCount;
+
+      // The vectors below and those of the ordering calls stay out of the
+      // arenas, so a bound of what they hold at once counts towards the
+      // splitter usage: the cells, plus the node graph with the search
+      // arrays, or the coordinates with the Hilbert keys, or the cell keys
+      size_t cellBytes = size_t(localMesh.cellsCount) * 4 * sizeof(IndexType);
+      size_t nodeBytes = size_t(localNodesCount) * sizeof(IndexType);
+      size_t orderBytes = nodeOrder == node_order_rcm ? 3 * cellBytes + 6 * nodeBytes : 11 * nodeBytes;
+      HeldBytes workBytes(&arenaUsage, cellBytes + std::max(std::max(orderBytes, 5 * nodeBytes), 3 * cellBytes));
+
+      std::vector<IndexType> localCells(localMesh.cellsCount * 4);
+      for(IndexType i = 0; i < localMesh.cellsCount * 4; i++)
+      {
+        localCells[i] = GetNodeLocalIndex(meshIndex, localMesh.cellGlobalIndices[i]);
+      }
+
+      std::vector<IndexType> order;
+      if(nodeOrder == node_order_rcm)
+      {
+        get_rcm_order(localNodesCount, localCells, order);
+      }
+      else
+      {
+        std::vector<REAL> coords(localNodesCount * 3);
+        for(IndexType localNodeIndex = 0; localNodeIndex < localNodesCount; localNodeIndex++)
+        {
+          for(int i = 0; i < 3; i++)
+            coords[localNodeIndex * 3 + i] = nodeCoords[localMesh.nodeGlobalIndices[localNodeIndex] * 3 + i];
+        }
+        get_hilbert_order(coords, order);
+      }
+
+      std::vector< std::pair<IndexType, IndexType> > blocks(localNodesCount);
+      for(IndexType position = 0; position < localNodesCount; position++)
+      {
+        IndexType nodeGlobalIndex = localMesh.nodeGlobalIndices[order[position]];
+        blocks[position].first = IndexType(std::upper_bound(subMeshEnd.begin(), subMeshEnd.end(), nodeGlobalIndex) - subMeshEnd.begin());
+        blocks[position].second = position;
+      }
+      std::sort(blocks.begin(), blocks.end());
+
+      std::vector<IndexType> newLocalIndex(localNodesCount);
+      std::vector<IndexType> nodeGlobalIndices(localMesh.nodeGlobalIndices, localMesh.nodeGlobalIndices + localNodesCount);
+      for(IndexType position = 0; position < localNodesCount; position++)
+      {
+        newLocalIndex[order[blocks[position].second]] = position;
+      }
+      for(IndexType localNodeIndex = 0; localNodeIndex < localNodesCount; localNodeIndex++)
+      {
+        SetNodeLocalIndex(meshIndex, nodeGlobalIndices[localNodeIndex], newLocalIndex[localNodeIndex]);
+        localMesh.nodeGlobalIndices[newLocalIndex[localNodeIndex]] = nodeGlobalIndices[localNodeIndex];
+      }
+      for(IndexType i = 0; i < localMesh.cellsCount * 4; i++)
+      {
+        localCells[i] = newLocalIndex[localCells[i]];
+      }
+
+      std::vector<IndexType> cellGlobalIndices(localMesh.cellGlobalIndices, localMesh.cellGlobalIndices + localMesh.cellsCount * 4);
+      IndexType groups[4] = {0, cellBlocks ? localMesh.interiorCellsCount : 0, localMesh.ownCellsCount, localMesh.cellsCount};
+      for(int group = 0; group < 3; group++)
+      {
+        get_cells_order(localCells, groups[group], groups[group + 1], order);
+        for(IndexType position = 0; position < order.size(); position++)
+        {
+          for(int i = 0; i < 4; i++)
+            localMesh.cellGlobalIndices[(groups[group] + position) * 4 + i] = cellGlobalIndices[order[position] * 4 + i];
+        }
+      }
+    }
+
     void ComputeLocalSubmeshes(IndexType *subMeshNodesCount, IndexType subMeshesCount)
     {
       for(IndexType meshIndex = 0; meshIndex < meshesCount; meshIndex++)
       {
         localMeshes[meshIndex].subMeshesCount = subMeshesCount;
-        localMeshes[meshIndex].subMeshNodesCount = new IndexType[subMeshesCount];
+        localMeshes[meshIndex].subMeshNodesCount = storage.Allocate<IndexType>(subMeshesCount);
         for(IndexType subMeshIndex = 0; subMeshIndex < subMeshesCount; subMeshIndex++)
         {
           localMeshes[meshIndex].subMeshNodesCount[subMeshIndex] = 0;
@@ -1000,7 +1243,7 @@ private:
       {
         localMeshes[meshIndex].contactFaces = 0;
         localMeshes[meshIndex].contactTypesCount = contactTypesCount;
-        localMeshes[meshIndex].contactFacesCount = new IndexType[contactTypesCount];
+        localMeshes[meshIndex].contactFacesCount = storage.Allocate<IndexType>(contactTypesCount);
 
         for(IndexType contactTypeIndex = 0; contactTypeIndex < contactTypesCount; contactTypeIndex++)
         {
@@ -1053,7 +1296,7 @@ private:
         }
       }
 
-      localContactFacesPool = new ContactFace[contactFacesPoolSize];
+      localContactFacesPool = storage.Allocate<ContactFace>(contactFacesPoolSize);
       IndexType offset = 0;
       for(IndexType meshIndex = 0; meshIndex < meshesCount; meshIndex++)
       {
@@ -1119,7 +1362,7 @@ private:
       {
         localMeshes[meshIndex].boundaryFaces = 0;
         localMeshes[meshIndex].boundaryTypesCount = boundaryTypesCount;
-        localMeshes[meshIndex].boundaryFacesCount = new IndexType[boundaryTypesCount];
+        localMeshes[meshIndex].boundaryFacesCount = storage.Allocate<IndexType>(boundaryTypesCount);
         for(IndexType boundaryTypeIndex = 0; boundaryTypeIndex < boundaryTypesCount; boundaryTypeIndex++)
         {
           localMeshes[meshIndex].boundaryFacesCount[boundaryTypeIndex] = 0;
@@ -1168,7 +1411,7 @@ private:
         }
       }
 
-      localBoundaryFacesPool = new BoundaryFace[boundaryFacesPoolSize];
+      localBoundaryFacesPool = storage.Allocate<BoundaryFace>(boundaryFacesPoolSize);
       IndexType offset = 0;
       for(IndexType meshIndex = 0; meshIndex < meshesCount; meshIndex++)
       {
@@ -1239,14 +1482,17 @@ private:
       IndexType *nodeGlobalIndices;
 
       IndexType cellsCount;
+      IndexType ownCellsCount;
+      IndexType interiorCellsCount;
       IndexType *cellGlobalIndices;
 
-      std::vector<IndexType> destRegionId;
+      IndexType sharedRegionsCount;
+      IndexType *destRegionId;
 
-      std::vector<IndexType> transitionNodesCount;
+      IndexType *transitionNodesCount;
       IndexType **transitionNodesGlobalIndices;
 
-      std::vector<IndexType> sharedCellsCount;
+      IndexType *sharedCellsCount;
       IndexType **sharedCellsGlobalIndices;
       IndexType **sharedCellsTransitionIndices;
 
@@ -1278,14 +1524,25 @@ private:
     struct NodeInfo
     {
       IndexType incidentRegionsCount;
-      IndexType *incindentRegionId;
-      IndexType *localIndex;
+      const IndexType *incindentRegionId;
       IndexType tmpIndex;
     };
-    IndexType *incidentRegionIdPool;
-    IndexType *localIndexPool;
+    RegionBuilder expandedRegions;
+    NodeLocalIndexMap nodeLocalIndices;
 
     NodeInfo *nodeInfo;
 
+    node_order nodeOrder;
+    const REAL *nodeCoords;
+    int threadsCount;
+
+    bool cellBlocks;
+    char *isSharedCell;
+
+    // Storage holds what the getters read, scratch the working arrays
+    // dropped once the meshes are loaded
+    ArenaUsage arenaUsage;
+    MemoryArena storage;
+    MemoryArena scratch;
   };
 } //namespace swift
@@ -0,0 +1,212 @@
+/*****************************************************************************
+* name: node_ordering.h
+*
+* author: Biryukov V. biryukov.vova@gmail.com
+*
+* desc: Locality preserving orders of submesh nodes and cells
+*
+* license: GPLv3
+*
+*****************************************************************************/
+
+#pragma once
+#include <vector>
+#include <algorithm>
+#include "partitioner.h"
+#include "settings.h"
+namespace swift
+{
+    enum node_order
+    {
+        node_order_none,
+        node_order_rcm,     // reverse Cuthill-McKee on the node graph
+        node_order_hilbert  // along a Hilbert curve through the nodes
+    };
+
+    // Returns false for an unknown name
+    inline bool get_node_order_by_name(const std::string & name, node_order & order)
+    {
+        if (name == "None")
+            order = node_order_none;
+        else if (name == "RCM")
+            order = node_order_rcm;
+        else if (name == "Hilbert")
+            order = node_order_hilbert;
+        else
+            return false;
+        return true;
+    }
+
+    // Lower degree first, then lower index
+    struct degree_less
+    {
+        const std::vector<int_t> & xadj;
+        degree_less(const std::vector<int_t> & xadj_t) : xadj(xadj_t) {}
+        bool operator()(int_t a, int_t b) const
+        {
+            int_t da = xadj[a+1] - xadj[a], db = xadj[b+1] - xadj[b];
+            return da < db || (da == db && a < b);
+        }
+    };
+
+    // Sorted nodes of a cell
+    struct cell_key
+    {
+        int_t nodes[4];
+        bool operator<(const cell_key & k) const
+        {
+            return std::lexicographical_compare(nodes, nodes + 4, k.nodes, k.nodes + 4);
+        }
+    };
+
+    // Nodes sharing a cell are neighbours, in compressed rows
+    inline void get_node_graph(int_t nodes_count, const std::vector<int_t> & cells, std::vector<int_t> & xadj, std::vector<int_t> & adjncy)
+    {
+        xadj.assign(nodes_count + 1, 0);
+        for (unsigned int i = 0; i < cells.size(); i++)
+            xadj[cells[i] + 1] += 3;
+        for (int_t i = 0; i < nodes_count; i++)
+            xadj[i+1] += xadj[i];
+        adjncy.resize(xadj.back());
+        std::vector<int_t> next(xadj.begin(), xadj.end() - 1);
+        for (unsigned int c = 0; c < cells.size() / 4; c++)
+            for (int i = 0; i < 4; i++)
+                for (int j = 0; j < 4; j++)
+                    if (i != j)
+                        adjncy[next[cells[4*c + i]]++] = cells[4*c + j];
+        // Drop the neighbours met through several cells
+        int_t size = 0;
+        for (int_t u = 0; u < nodes_count; u++)
+        {
+            int_t begin = xadj[u];
+            xadj[u] = size;
+            std::sort(adjncy.begin() + begin, adjncy.begin() + xadj[u+1]);
+            int_t end = std::unique(adjncy.begin() + begin, adjncy.begin() + xadj[u+1]) - adjncy.begin();
+            for (int_t e = begin; e < end; e++)
+                adjncy[size++] = adjncy[e];
+        }
+        xadj[nodes_count] = size;
+        adjncy.resize(size);
+    }
+
+    // Breadth first levels of the component of start, listed in visiting
+    // order. Leaves the component marked as seen.
+    inline void get_levels(const std::vector<int_t> & xadj, const std::vector<int_t> & adjncy, int_t start,
+                           std::vector<char> & seen, std::vector<int_t> & level_of, std::vector<int_t> & component)
+    {
+        component.push_back(start);
+        seen[start] = 1;
+        level_of[start] = 0;
+        for (unsigned int head = 0; head < component.size(); head++)
+        {
+            int_t u = component[head];
+            for (int_t e = xadj[u]; e < xadj[u+1]; e++)
+                if (!seen[adjncy[e]])
+                {
+                    seen[adjncy[e]] = 1;
+                    level_of[adjncy[e]] = level_of[u] + 1;
+                    component.push_back(adjncy[e]);
+                }
+        }
+    }
+
+    // Reverse Cuthill-McKee: breadth first from a low degree node far from
+    // the rest of its component, neighbours by increasing degree, reversed.
+    // order[k] is the node that goes to position k.
+    inline void get_rcm_order(int_t nodes_count, const std::vector<int_t> & cells, std::vector<int_t> & order)
+    {
+        std::vector<int_t> xadj, adjncy;
+        get_node_graph(nodes_count, cells, xadj, adjncy);
+        std::vector<char> seen(nodes_count, 0);
+        std::vector<int_t> level_of(nodes_count);
+        std::vector<int_t> by_degree(nodes_count);
+        for (int_t i = 0; i < nodes_count; i++)
+            by_degree[i] = i;
+        degree_less less(xadj);
+        std::sort(by_degree.begin(), by_degree.end(), less);
+        order.clear();
+        order.reserve(nodes_count);
+        for (int_t k = 0; k < nodes_count; k++)
+        {
+            int_t start = by_degree[k];
+            if (seen[start])
+                continue;
+            // A couple of sweeps move the start to the far end of the component
+            for (int sweep = 0; sweep < 2; sweep++)
+            {
+                std::vector<int_t> component;
+                get_levels(xadj, adjncy, start, seen, level_of, component);
+                for (unsigned int i = 0; i < component.size(); i++)
+                    seen[component[i]] = 0;
+                int_t far = start;
+                for (unsigned int i = 0; i < component.size(); i++)
+                {
+                    int_t u = component[i];
+                    if (level_of[u] > level_of[far] || (level_of[u] == level_of[far] && less(u, far)))
+                        far = u;
+                }
+                start = far;
+            }
+            unsigned int first = order.size();
+            order.push_back(start);
+            seen[start] = 1;
+            std::vector<int_t> neighbours;
+            for (unsigned int head = first; head < order.size(); head++)
+            {
+                int_t u = order[head];
+                neighbours.clear();
+                for (int_t e = xadj[u]; e < xadj[u+1]; e++)
+                    if (!seen[adjncy[e]])
+                    {
+                        seen[adjncy[e]] = 1;
+                        neighbours.push_back(adjncy[e]);
+                    }
+                std::sort(neighbours.begin(), neighbours.end(), less);
+                order.insert(order.end(), neighbours.begin(), neighbours.end());
+            }
+        }
+        std::reverse(order.begin(), order.end());
+    }
+
+    // Nodes along a Hilbert curve through their bounding box. coordinates
+    // holds x, y, z of every node in turn.
+    inline void get_hilbert_order(const std::vector<REAL> & coordinates, std::vector<int_t> & order)
+    {
+        int_t nodes_count = coordinates.size() / 3;
+        REAL lo[3], hi[3];
+        get_bounding_box(coordinates, NULL, 0, nodes_count, lo, hi);
+        REAL extent = std::max(hi[0] - lo[0], std::max(hi[1] - lo[1], hi[2] - lo[2]));
+        REAL scale = (extent > 0) ? ((1 << 21) - 1) / extent : 0;
+        std::vector< std::pair<unsigned long long, int_t> > keys(nodes_count);
+        for (int_t i = 0; i < nodes_count; i++)
+        {
+            unsigned int q[3];
+            for (int d = 0; d < 3; d++)
+                q[d] = (unsigned int)((coordinates[3*i + d] - lo[d]) * scale);
+            keys[i] = std::make_pair(get_hilbert_key(q), i);
+        }
+        std::sort(keys.begin(), keys.end());
+        order.resize(nodes_count);
+        for (int_t i = 0; i < nodes_count; i++)
+            order[i] = keys[i].second;
+    }
+
+    // Order of the cells in [begin, end) by their sorted node indices, so
+    // that consecutive cells touch nearby nodes. order[k] is the cell that
+    // goes to position begin + k.
+    inline void get_cells_order(const std::vector<int_t> & cells, int_t begin, int_t end, std::vector<int_t> & order)
+    {
+        std::vector< std::pair<cell_key, int_t> > keys(end - begin);
+        for (int_t c = begin; c < end; c++)
+        {
+            cell_key & k = keys[c - begin].first;
+            std::copy(&cells[4*c], &cells[4*c] + 4, k.nodes);
+            std::sort(k.nodes, k.nodes + 4);
+            keys[c - begin].second = c;
+        }
+        std::sort(keys.begin(), keys.end());
+        order.resize(end - begin);
+        for (int_t i = 0; i < end - begin; i++)
+            order[i] = keys[i].second;
+    }
+}
@@ -0,0 +1,97 @@
+/*****************************************************************************
+* name: parallel.h
+*
+* author: Biryukov V. biryukov.vova@gmail.com
+*
+* desc: Minimal thread pool helpers for data-parallel loops
+*
+* license: GPLv3
+*
+*****************************************************************************/
+
+#pragma once
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+namespace swift
+{
+    // Number of workers used when a caller asks for 0 threads
+    inline int get_default_threads_count()
+    {
+        int n = int(std::thread::hardware_concurrency());
+        return (n > 0) ? n : 1;
+    }
+
+    // Calls f(i) for every i in [0, n) on up to threads_count workers.
+    // Items are handed out in blocks of grain indices from a shared counter,
+    // so uneven work balances itself. f must not depend on the call order.
+    template<typename F>
+    void parallel_for(int n, int threads_count, F f, int grain = 1)
+    {
+        if (threads_count <= 0)
+            threads_count = get_default_threads_count();
+        if (grain < 1)
+            grain = 1;
+        if (threads_count > (n + grain - 1) / grain)
+            threads_count = (n + grain - 1) / grain;
+        if (threads_count <= 1)
+        {
+            for (int i = 0; i < n; i++)
+                f(i);
+            return;
+        }
+
+        std::atomic<int> next(0);
+        F & body = f;
+        auto worker = [&next, &body, n, grain]()
+        {
+            for (int begin = next.fetch_add(grain); begin < n; begin = next.fetch_add(grain))
+            {
+                int end = (begin + grain < n) ? begin + grain : n;
+                for (int i = begin; i < end; i++)
+                    body(i);
+            }
+        };
+        std::vector<std::thread> workers;
+        for (int t = 1; t < threads_count; t++)
+            workers.push_back(std::thread(worker));
+        worker();
+        for (unsigned int t = 0; t < workers.size(); t++)
+            workers[t].join();
+    }
+
+    // Sorts blocks of the range concurrently and merges them pairwise.
+    // With a strict total order the result does not depend on threads_count.
+    template<typename It, typename Compare>
+    void parallel_sort(It first, It last, Compare comp, int threads_count)
+    {
+        if (threads_count <= 0)
+            threads_count = get_default_threads_count();
+        long n = long(last - first);
+        int blocks = threads_count;
+        if (blocks <= 1 || n < 4096 * blocks)
+        {
+            std::sort(first, last, comp);
+            return;
+        }
+        std::vector<long> bounds(blocks + 1);
+        for (int i = 0; i <= blocks; i++)
+            bounds[i] = n * i / blocks;
+        parallel_for(blocks, threads_count, [&](int i)
+        {
+            std::sort(first + bounds[i], first + bounds[i+1], comp);
+        });
+        for (int width = 1; width < blocks; width *= 2)
+        {
+            parallel_for((blocks + 2 * width - 1) / (2 * width), threads_count, [&](int i)
+            {
+                int a = 2 * width * i;
+                int b = std::min(a + width, blocks);
+                int c = std::min(a + 2 * width, blocks);
+                if (b < c)
+                    std::inplace_merge(first + bounds[a], first + bounds[b], first + bounds[c], comp);
+            });
+        }
+    }
+}
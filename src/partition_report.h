@@ -0,0 +1,119 @@
+/*****************************************************************************
+* name: partition_report.h
+*
+* author: Biryukov V. biryukov.vova@gmail.com
+*
+* desc: Quality report of a mesh partition saved as JSON
+*
+* license: GPLv3
+*
+*****************************************************************************/
+
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include "settings.h"
+namespace swift
+{
+    // What a part shares with one of its neighbours
+    struct region_pair
+    {
+        int_t src, dst;
+        int_t shared_cells, transition_nodes;
+    };
+
+    // Filled part by part while the submeshes are saved. Halo bytes are
+    // estimated for one REAL per transition node and exchange.
+    struct partition_report
+    {
+        std::string method;
+        int_t cells_count, nodes_count;
+        std::vector<int_t> own_cells, cells, nodes, contact_faces, boundary_faces;
+        std::vector<region_pair> pairs;
+
+        partition_report() : cells_count(0), nodes_count(0) {}
+
+        void add_part(int_t own_cells_t, int_t cells_t, int_t nodes_t, int_t contact_faces_t, int_t boundary_faces_t)
+        {
+            own_cells.push_back(own_cells_t);
+            cells.push_back(cells_t);
+            nodes.push_back(nodes_t);
+            contact_faces.push_back(contact_faces_t);
+            boundary_faces.push_back(boundary_faces_t);
+        }
+
+        void add_pair(int_t src, int_t dst, int_t shared_cells, int_t transition_nodes)
+        {
+            region_pair p = {src, dst, shared_cells, transition_nodes};
+            pairs.push_back(p);
+        }
+
+        // Largest value over the average, 1 for a perfect balance
+        static double get_imbalance(const std::vector<int_t> & v)
+        {
+            if (v.empty())
+                return 1;
+            double sum = 0;
+            for (unsigned int i = 0; i < v.size(); i++)
+                sum += v[i];
+            return (sum > 0) ? *std::max_element(v.begin(), v.end()) * v.size() / sum : 1;
+        }
+
+        bool save(const std::string & path) const
+        {
+            int_t parts_count = cells.size();
+            std::vector<int_t> neighbours(parts_count, 0);
+            std::vector<unsigned long long> halo_bytes(parts_count, 0);
+            unsigned long long shared_total = 0, transition_total = 0;
+            for (unsigned int i = 0; i < pairs.size(); i++)
+            {
+                neighbours[pairs[i].src]++;
+                halo_bytes[pairs[i].src] += (unsigned long long)pairs[i].transition_nodes * sizeof(REAL);
+                shared_total += pairs[i].shared_cells;
+                transition_total += pairs[i].transition_nodes;
+            }
+            std::vector<int_t> histogram(parts_count ? *std::max_element(neighbours.begin(), neighbours.end()) + 1 : 0, 0);
+            for (int_t i = 0; i < parts_count; i++)
+                histogram[neighbours[i]]++;
+
+            std::ofstream file(path.c_str());
+            file << "{\n";
+            file << "  \"method\": \"" << method << "\",\n";
+            file << "  \"parts\": " << parts_count << ",\n";
+            file << "  \"cells\": " << cells_count << ",\n";
+            file << "  \"nodes\": " << nodes_count << ",\n";
+            file << "  \"cell_imbalance\": " << get_imbalance(own_cells) << ",\n";
+            file << "  \"node_imbalance\": " << get_imbalance(nodes) << ",\n";
+            file << "  \"shared_cells\": " << shared_total << ",\n";
+            file << "  \"transition_nodes\": " << transition_total << ",\n";
+            file << "  \"halo_bytes\": " << transition_total * sizeof(REAL) << ",\n";
+            file << "  \"neighbours_histogram\": [";
+            for (unsigned int i = 0; i < histogram.size(); i++)
+                file << (i ? ", " : "") << histogram[i];
+            file << "],\n";
+            file << "  \"regions\": [\n";
+            for (int_t i = 0; i < parts_count; i++)
+            {
+                file << "    {\"id\": " << i << ", \"own_cells\": " << own_cells[i] << ", \"cells\": " << cells[i]
+                     << ", \"nodes\": " << nodes[i] << ", \"contact_faces\": " << contact_faces[i]
+                     << ", \"boundary_faces\": " << boundary_faces[i] << ", \"neighbours\": " << neighbours[i]
+                     << ", \"halo_bytes\": " << halo_bytes[i] << "}" << ((i + 1 < parts_count) ? "," : "") << "\n";
+            }
+            file << "  ],\n";
+            file << "  \"pairs\": [\n";
+            for (unsigned int i = 0; i < pairs.size(); i++)
+            {
+                file << "    {\"src\": " << pairs[i].src << ", \"dst\": " << pairs[i].dst
+                     << ", \"shared_cells\": " << pairs[i].shared_cells << ", \"transition_nodes\": " << pairs[i].transition_nodes
+                     << ", \"halo_bytes\": " << (unsigned long long)pairs[i].transition_nodes * sizeof(REAL) << "}"
+                     << ((i + 1 < pairs.size()) ? "," : "") << "\n";
+            }
+            file << "  ]\n";
+            file << "}\n";
+            file.close();
+            return bool(file);
+        }
+    };
+}
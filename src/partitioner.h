@@ -0,0 +1,281 @@
+/*****************************************************************************
+* name: partitioner.h
+*
+* author: Biryukov V. biryukov.vova@gmail.com
+*
+* desc: Partitioners of the volume mesh cells into submeshes
+*
+* license: GPLv3
+*
+*****************************************************************************/
+
+#pragma once
+#include <vector>
+#include <string>
+#include <utility>
+#include <algorithm>
+#include <cmath>
+#include "parallel.h"
+#include "settings.h"
+namespace swift
+{
+    // Assigns each cell to a part. centres holds x, y, z of every cell in
+    // turn and cells its four node indices; the result must not depend on
+    // threads_count.
+    struct partitioner
+    {
+        virtual ~partitioner() {}
+        virtual void partition(const std::vector<REAL> & centres, const int * cells, int_t parts_count, int threads_count, std::vector<int_t> & parts) = 0;
+    };
+
+    // Bounding box of the centres in [begin, end) of order, or of all
+    // centres if order is NULL
+    inline void get_bounding_box(const std::vector<REAL> & centres, const int_t * order, int_t begin, int_t end, REAL lo[3], REAL hi[3])
+    {
+        for (int d = 0; d < 3; d++)
+        {
+            lo[d] = HUGE_VAL;
+            hi[d] = -HUGE_VAL;
+        }
+        for (int_t i = begin; i < end; i++)
+        {
+            const REAL * c = &centres[3 * (order ? order[i] : i)];
+            for (int d = 0; d < 3; d++)
+            {
+                lo[d] = std::min(lo[d], c[d]);
+                hi[d] = std::max(hi[d], c[d]);
+            }
+        }
+    }
+
+    // Values of the given ranks in sorted order, found by nested
+    // nth_element calls. ranks must increase and stay below values.size().
+    // Ranges of the same depth are selected concurrently.
+    inline void select_ranks(std::vector<REAL> & values, const std::vector<int_t> & ranks, int threads_count, std::vector<REAL> & selected)
+    {
+        struct range
+        {
+            int_t begin, end;
+            int first, last;
+        };
+        selected.resize(ranks.size());
+        std::vector<range> level;
+        if (!ranks.empty())
+        {
+            range all = {0, int_t(values.size()), 0, int(ranks.size())};
+            level.push_back(all);
+        }
+        while (!level.empty())
+        {
+            std::vector<range> next(2 * level.size());
+            parallel_for(level.size(), threads_count, [&](int i)
+            {
+                const range & r = level[i];
+                int mid = (r.first + r.last) / 2;
+                int_t k = ranks[mid];
+                std::nth_element(values.begin() + r.begin, values.begin() + k, values.begin() + r.end);
+                selected[mid] = values[k];
+                range a = {r.begin, k, r.first, mid};
+                range b = {k + 1, r.end, mid + 1, r.last};
+                next[2*i] = a;
+                next[2*i+1] = b;
+            });
+            level.clear();
+            for (unsigned int i = 0; i < next.size(); i++)
+                if (next[i].first < next[i].last)
+                    level.push_back(next[i]);
+        }
+    }
+
+    /*****************************************************************************
+    *  Slabs along the axes
+    *****************************************************************************/
+
+    // The original scheme: x * y * z parts by the quantiles of the centres
+    // along each axis. A cell goes past the s-th slab boundary if its
+    // coordinate is above the value of rank s * n / count, which only takes
+    // a selection of count - 1 ranks instead of a full sort. parts_count is
+    // ignored.
+    struct slab_partitioner : public partitioner
+    {
+        int x, y, z;
+
+        slab_partitioner(int x_t, int y_t, int z_t) : x(x_t), y(y_t), z(z_t) {}
+
+        void partition(const std::vector<REAL> & centres, const int * cells, int_t parts_count, int threads_count, std::vector<int_t> & parts)
+        {
+            int_t cells_count = centres.size() / 3;
+            parts.assign(cells_count, 0);
+            int counts[3] = {x, y, z};
+            int_t stride = 1;
+            // One coordinate of all cells, reordered by the selection
+            std::vector<REAL> values(cells_count);
+            std::vector<int_t> ranks, unique_ranks;
+            std::vector<REAL> bounds, selected;
+            for (int axis = 0; axis < 3; axis++)
+            {
+                ranks.clear();
+                for (int s = 1; s < counts[axis] && cells_count > 0; s++)
+                    ranks.push_back(int_t((unsigned long long)s * cells_count / counts[axis]));
+                // With fewer cells than slabs ranks repeat, every boundary still counts
+                unique_ranks = ranks;
+                unique_ranks.erase(std::unique(unique_ranks.begin(), unique_ranks.end()), unique_ranks.end());
+                parallel_for(cells_count, threads_count, [&](int i)
+                {
+                    values[i] = centres[3*i + axis];
+                }, 4096);
+                select_ranks(values, unique_ranks, threads_count, selected);
+                bounds.resize(ranks.size());
+                for (unsigned int s = 0; s < ranks.size(); s++)
+                    bounds[s] = selected[std::lower_bound(unique_ranks.begin(), unique_ranks.end(), ranks[s]) - unique_ranks.begin()];
+                parallel_for(cells_count, threads_count, [&](int i)
+                {
+                    int_t segment = std::lower_bound(bounds.begin(), bounds.end(), centres[3*i + axis]) - bounds.begin();
+                    parts[i] += stride * segment;
+                }, 4096);
+                stride *= counts[axis];
+            }
+        }
+    };
+
+    /*****************************************************************************
+    *  Hilbert curve
+    *****************************************************************************/
+
+    // Index along the 3D Hilbert curve of a point with 21-bit coordinates
+    // (Skilling's transpose form, then bit interleaving)
+    inline unsigned long long get_hilbert_key(unsigned int x[3])
+    {
+        const int bits = 21;
+        unsigned int m = 1u << (bits - 1), t;
+        for (unsigned int q = m; q > 1; q >>= 1)
+        {
+            unsigned int p = q - 1;
+            for (int i = 0; i < 3; i++)
+            {
+                if (x[i] & q)
+                    x[0] ^= p;
+                else
+                {
+                    t = (x[0] ^ x[i]) & p;
+                    x[0] ^= t;
+                    x[i] ^= t;
+                }
+            }
+        }
+        for (int i = 1; i < 3; i++)
+            x[i] ^= x[i-1];
+        t = 0;
+        for (unsigned int q = m; q > 1; q >>= 1)
+            if (x[2] & q)
+                t ^= q - 1;
+        for (int i = 0; i < 3; i++)
+            x[i] ^= t;
+        unsigned long long key = 0;
+        for (int b = bits - 1; b >= 0; b--)
+            for (int i = 0; i < 3; i++)
+                key = (key << 1) | ((x[i] >> b) & 1);
+        return key;
+    }
+
+    // Orders the cells along a Hilbert curve through the bounding box of
+    // the centres and cuts the order into parts of equal cell counts
+    struct hilbert_partitioner : public partitioner
+    {
+        void partition(const std::vector<REAL> & centres, const int * cells, int_t parts_count, int threads_count, std::vector<int_t> & parts)
+        {
+            int_t cells_count = centres.size() / 3;
+            REAL lo[3], hi[3];
+            get_bounding_box(centres, NULL, 0, cells_count, lo, hi);
+            REAL extent = std::max(hi[0] - lo[0], std::max(hi[1] - lo[1], hi[2] - lo[2]));
+            REAL scale = (extent > 0) ? ((1 << 21) - 1) / extent : 0;
+
+            std::vector< std::pair<unsigned long long, int_t> > order(cells_count);
+            parallel_for(cells_count, threads_count, [&](int i)
+            {
+                unsigned int q[3];
+                for (int d = 0; d < 3; d++)
+                    q[d] = (unsigned int)((centres[3*i + d] - lo[d]) * scale);
+                order[i] = std::make_pair(get_hilbert_key(q), int_t(i));
+            }, 4096);
+            parallel_sort(order.begin(), order.end(), std::less< std::pair<unsigned long long, int_t> >(), threads_count);
+
+            parts.resize(cells_count);
+            parallel_for(cells_count, threads_count, [&](int r)
+            {
+                parts[order[r].second] = int_t((unsigned long long)r * parts_count / cells_count);
+            }, 4096);
+        }
+    };
+
+    /*****************************************************************************
+    *  Recursive coordinate bisection
+    *****************************************************************************/
+
+    // Splits the cells across the longest side of their bounding box into
+    // halves sized by the part counts on either side, and recurses. Ranges
+    // of a level are split concurrently.
+    struct rcb_partitioner : public partitioner
+    {
+        struct range
+        {
+            int_t begin, end, first_part, parts_count;
+        };
+
+        struct axis_less
+        {
+            const REAL * centres;
+            int axis;
+            axis_less(const REAL * c, int a) : centres(c), axis(a) {}
+            bool operator()(int_t a, int_t b) const
+            {
+                REAL ca = centres[3*a + axis], cb = centres[3*b + axis];
+                return ca < cb || (ca == cb && a < b);
+            }
+        };
+
+        void partition(const std::vector<REAL> & centres, const int * cells, int_t parts_count, int threads_count, std::vector<int_t> & parts)
+        {
+            int_t cells_count = centres.size() / 3;
+            parts.assign(cells_count, 0);
+            std::vector<int_t> order(cells_count);
+            for (int_t i = 0; i < cells_count; i++)
+                order[i] = i;
+            range all = {0, cells_count, 0, parts_count};
+            std::vector<range> level(1, all);
+            while (!level.empty())
+            {
+                std::vector<range> next(2 * level.size());
+                parallel_for(level.size(), threads_count, [&](int i)
+                {
+                    const range & r = level[i];
+                    range none = {0, 0, 0, 0};
+                    next[2*i] = next[2*i+1] = none;
+                    if (r.parts_count <= 1 || r.end - r.begin <= 1)
+                    {
+                        for (int_t j = r.begin; j < r.end; j++)
+                            parts[order[j]] = r.first_part;
+                        return;
+                    }
+                    REAL lo[3], hi[3];
+                    get_bounding_box(centres, &order[0], r.begin, r.end, lo, hi);
+                    int axis = 0;
+                    for (int d = 1; d < 3; d++)
+                        if (hi[d] - lo[d] > hi[axis] - lo[axis])
+                            axis = d;
+                    int_t left = r.parts_count / 2;
+                    int_t mid = r.begin + int_t((unsigned long long)(r.end - r.begin) * left / r.parts_count);
+                    std::nth_element(order.begin() + r.begin, order.begin() + mid, order.begin() + r.end, axis_less(&centres[0], axis));
+                    range a = {r.begin, mid, r.first_part, left};
+                    range b = {mid, r.end, r.first_part + left, r.parts_count - left};
+                    next[2*i] = a;
+                    next[2*i+1] = b;
+                });
+                level.clear();
+                for (unsigned int i = 0; i < next.size(); i++)
+                    if (next[i].parts_count > 0)
+                        level.push_back(next[i]);
+            }
+        }
+    };
+}
@@ -55,20 +55,20 @@ namespace swift
         inline REAL norm( void ) const
         { return sqrt(x*x + y*y + z*z); }
 
-        inline REAL dot( const point& A )
+        inline REAL dot( const point& A ) const
         { return x*A.x + y*A.y + z*A.z; }
 
-        inline point vec (const point& A )
+        inline point vec (const point& A ) const
         { return point( y * A.z - A.y * z, -x * A.z + z * A.x, x * A.y - y * A.x ); }
 
-        inline REAL vecz (const point& A )
+        inline REAL vecz (const point& A ) const
         { return  x * A.y - y * A.x; }
 
-        REAL projx (point n, point new_x)
+        REAL projx (point n, point new_x) const
         {
             return (*this - n * n.dot(*this)).dot(new_x);
         }
-        REAL projy (point n, point new_x)
+        REAL projy (point n, point new_x) const
         {
             return (*this - n * n.dot(*this)).vec(new_x).dot(n);
         }
@@ -0,0 +1,149 @@
+/*****************************************************************************
+* name: point_index.h
+*
+* author: Biryukov V. biryukov.vova@gmail.com
+*
+* desc: Spatial hash over a figure's points for welding coincident points
+*
+* license: GPLv3
+*
+*****************************************************************************/
+
+#pragma once
+#include <vector>
+#include <cmath>
+#include <unordered_map>
+#include "point.h"
+#include "settings.h"
+namespace swift
+{
+    // Hashes points into cubic cells twice as wide as the point::operator==
+    // tolerance, so two equal points always lie in the same or adjacent cells.
+    // Lookups return the lowest matching index, exactly like std::find.
+    struct point_index
+    {
+        struct cell_key
+        {
+            long long i, j, k;
+            inline bool operator==(const cell_key& A) const
+            { return i == A.i && j == A.j && k == A.k; }
+        };
+
+        struct cell_hash
+        {
+            inline size_t operator()(const cell_key& c) const
+            {
+                unsigned long long h = (unsigned long long)c.i * 73856093ULL;
+                h ^= (unsigned long long)c.j * 19349663ULL;
+                h ^= (unsigned long long)c.k * 83492791ULL;
+                return size_t(h ^ (h >> 29));
+            }
+        };
+
+        REAL cell_size;
+        std::unordered_map<cell_key, int, cell_hash> head;
+        std::vector<int> next;
+
+        point_index( REAL tolerance = 1e-10 )
+        {
+            cell_size = 2 * tolerance;
+        }
+
+        void clear()
+        {
+            head.clear();
+            next.clear();
+        }
+
+        // Like clear, but also gives back the buckets and the chain storage
+        void release()
+        {
+            std::unordered_map<cell_key, int, cell_hash>().swap(head);
+            std::vector<int>().swap(next);
+        }
+
+        // Number of leading points of the indexed vector already hashed
+        int size() const
+        {
+            return int(next.size());
+        }
+
+        // Finds a point equal to p, returns -1 if there is none
+        int find( const std::vector< point > & vp, const point & p )
+        {
+            sync(vp);
+            cell_key c = get_cell(p);
+            int result = -1;
+            for (int di = -1; di <= 1; di++)
+                for (int dj = -1; dj <= 1; dj++)
+                    for (int dk = -1; dk <= 1; dk++)
+                    {
+                        cell_key n = {c.i + di, c.j + dj, c.k + dk};
+                        std::unordered_map<cell_key, int, cell_hash>::const_iterator it = head.find(n);
+                        if (it == head.end())
+                            continue;
+                        for (int q = it->second; q != -1; q = next[q])
+                            if ((result == -1 || q < result) && vp[q] == p)
+                                result = q;
+                    }
+            return result;
+        }
+
+        // Appends p to vp and indexes it, returns its index
+        int add( std::vector< point > & vp, const point & p )
+        {
+            sync(vp);
+            vp.push_back(p);
+            insert(vp, vp.size()-1);
+            return vp.size()-1;
+        }
+
+        int find_or_add( std::vector< point > & vp, const point & p )
+        {
+            int i = find(vp, p);
+            return (i == -1) ? add(vp, p) : i;
+        }
+
+        // Indexes points appended to vp since the last call
+        void sync( const std::vector< point > & vp )
+        {
+            if (vp.size() < next.size())
+                clear();
+            for (int i = next.size(); i < int(vp.size()); i++)
+                insert(vp, i);
+        }
+
+    private:
+        void insert( const std::vector< point > & vp, int i )
+        {
+            cell_key c = get_cell(vp[i]);
+            std::unordered_map<cell_key, int, cell_hash>::iterator it = head.find(c);
+            if (it == head.end())
+            {
+                next.push_back(-1);
+                head[c] = i;
+            }
+            else
+            {
+                next.push_back(it->second);
+                it->second = i;
+            }
+        }
+
+        long long get_coord( REAL x ) const
+        {
+            // Clamped so that neighbour cells never overflow
+            const REAL lim = 4.0e18;
+            REAL q = floor(x / cell_size);
+            if (q > lim) q = lim;
+            if (q < -lim) q = -lim;
+            return (long long)q;
+        }
+
+        cell_key get_cell( const point & p ) const
+        {
+            cell_key c = {get_coord(p.x), get_coord(p.y), get_coord(p.z)};
+            return c;
+        }
+    };
+}
@@ -0,0 +1,149 @@
+/*****************************************************************************
+* name: triangle_workspace.h
+*
+* author: Biryukov V. biryukov.vova@gmail.com
+*
+* desc: Reusable triangulateio pair for calls to Triangle
+*
+* license: GPLv3
+*
+*****************************************************************************/
+
+#pragma once
+#include <stdlib.h>
+#include <sstream>
+#include <string>
+#include "settings.h"
+extern "C"
+{
+#include "triangle.h"
+}
+namespace swift
+{
+    // Owns the in/out structures of a triangulate() call. Input buffers and
+    // the switch string survive between calls and only grow (geometrically),
+    // output lists are allocated by Triangle and released before the next call.
+    struct triangle_workspace
+    {
+        struct triangulateio in, out;
+
+        triangle_workspace()
+        {
+            clear_io(in);
+            clear_io(out);
+            points_capacity = 0;
+            segments_capacity = 0;
+            switches_area = -1;
+        }
+
+        ~triangle_workspace()
+        {
+            release_output();
+            free(in.pointlist);
+            free(in.segmentlist);
+        }
+
+        // Sets the sizes of the input lists, keeping the old buffers if they fit
+        void set_input(int points_count, int segments_count)
+        {
+            if (points_count > points_capacity)
+            {
+                points_capacity = (2 * points_capacity > points_count) ? 2 * points_capacity : points_count;
+                in.pointlist = (REAL *) realloc(in.pointlist, points_capacity * 2 * sizeof(REAL));
+            }
+            if (segments_count > segments_capacity)
+            {
+                segments_capacity = (2 * segments_capacity > segments_count) ? 2 * segments_capacity : segments_count;
+                in.segmentlist = (int *) realloc(in.segmentlist, segments_capacity * 2 * sizeof(int));
+            }
+            in.numberofpoints = points_count;
+            in.numberofsegments = segments_count;
+        }
+
+        // Sets Triangle switches followed by the maximum triangle area
+        void set_switches(const std::string & flags, REAL area)
+        {
+            if (flags == switches_flags && area == switches_area)
+                return;
+            std::stringstream ss;
+            ss << flags << area;
+            ss >> switches;
+            switches_flags = flags;
+            switches_area = area;
+        }
+
+        void triangulate()
+        {
+            release_output();
+            ::triangulate(&switches[0], &in, &out, (struct triangulateio *) NULL);
+        }
+
+        // Frees the lists Triangle allocated for the last output
+        void release_output()
+        {
+            free(out.pointlist);
+            free(out.pointattributelist);
+            free(out.pointmarkerlist);
+            free(out.trianglelist);
+            free(out.triangleattributelist);
+            free(out.trianglearealist);
+            free(out.neighborlist);
+            free(out.segmentlist);
+            free(out.segmentmarkerlist);
+            free(out.edgelist);
+            free(out.edgemarkerlist);
+            free(out.normlist);
+            // holelist and regionlist are only copied from the input
+            clear_io(out);
+        }
+
+        // Workspace of the calling thread
+        static triangle_workspace & local()
+        {
+            static thread_local triangle_workspace ws;
+            return ws;
+        }
+
+    private:
+        int points_capacity;
+        int segments_capacity;
+        std::string switches;
+        std::string switches_flags;
+        REAL switches_area;
+
+        triangle_workspace(const triangle_workspace &);
+        triangle_workspace & operator=(const triangle_workspace &);
+
+        static void clear_io(struct triangulateio & io)
+        {
+            io.pointlist = (REAL*)(NULL);
+            io.pointattributelist = (REAL*)(NULL);
+            io.pointmarkerlist = (int*)(NULL);
+            io.numberofpoints = 0;
+            io.numberofpointattributes = 0;
+
+            io.trianglelist = (int*)(NULL);
+            io.triangleattributelist = (REAL*)(NULL);
+            io.trianglearealist = (REAL*)(NULL);
+            io.neighborlist = (int*)(NULL);
+            io.numberoftriangles = 0;
+            io.numberofcorners = 0;
+            io.numberoftriangleattributes = 0;
+
+            io.segmentlist = (int*)(NULL);
+            io.segmentmarkerlist = (int*)(NULL);
+            io.numberofsegments = 0;
+
+            io.holelist = (REAL*)(NULL);
+            io.numberofholes = 0;
+
+            io.regionlist = (REAL*)(NULL);
+            io.numberofregions = 0;
+
+            io.edgelist = (int*)(NULL);
+            io.edgemarkerlist = (int*)(NULL);
+            io.normlist = (REAL*)(NULL);
+            io.numberofedges = 0;
+        }
+    };
+}